@@ -0,0 +1,66 @@
+#include <hellfire.h>
+
+#define MAX_DELAY	500
+
+uint32_t tick_us, wakeups, early, late, max_early, max_late;
+
+/*
+ * a delay of n ticks started between two ticks ends on the n-th tick, so a wakeup is expected
+ * between n - 1 and n ticks of (real) time after the call. wakeups more than a tick off this
+ * window are counted as early or late. time is taken with _read_us(), as the tick is suppressed
+ * while the system is idle when TICKLESS is set.
+ */
+void sleeper(void){
+	uint32_t delay, time;
+	int32_t diff;
+	uint32_t status;
+
+	for(;;){
+		status = _di();
+		delay = (random() % MAX_DELAY) + 1;
+		_ei(status);
+
+		time = _read_us();
+		hf_delay(hf_selfid(), delay);
+		time = _read_us() - time;
+
+		status = _di();
+		diff = (int32_t)(time - delay * tick_us);
+		wakeups++;
+		if (diff < -(int32_t)tick_us){
+			early++;
+			if (-diff > max_early)
+				max_early = -diff;
+		}else if (diff > (int32_t)tick_us){
+			late++;
+			if (diff > max_late)
+				max_late = diff;
+		}
+		_ei(status);
+	}
+}
+
+/* measures the length of a tick between two consecutive wakeups, then spawns the sleepers */
+void monitor(void){
+	int32_t i;
+
+	hf_delay(hf_selfid(), 1);
+	tick_us = _read_us();
+	hf_delay(hf_selfid(), 1);
+	tick_us = _read_us() - tick_us;
+
+	for (i = 0; i < MAX_TASKS; i++)
+		if (hf_spawn(sleeper, 0, 0, 0, "sleeper", 512) < 0)
+			break;
+
+	for(;;){
+		hf_delay(hf_selfid(), 1000);
+		printf("\ntasks: %d, wakeups: %d, early: %d (max %d us), late: %d (max %d us), tick: %d us, free cpu: %d%%",
+			krnl_tasks, wakeups, early, max_early, late, max_late, tick_us, hf_freecpu());
+	}
+}
+
+void app_main(void){
+	srand(CPU_ID + 12345);
+	hf_spawn(monitor, 0, 0, 0, "monitor", 1024);
+}
@@ -20,6 +20,8 @@ void sender(void)
 				if (val) printf("sender, hf_sendack(): error %d\n", val);
 			}
 		}
+		val = hf_ackwait(500);
+		if (val) printf("sender, hf_ackwait(): error %d\n", val);
 		delay_ms(10);
 	}
 }
@@ -61,6 +63,8 @@ void sender2(void)
 				if (val) printf("sender2, hf_sendack(): error %d\n", val);
 			}
 		}
+		val = hf_ackwait(500);
+		if (val) printf("sender2, hf_ackwait(): error %d\n", val);
 		delay_ms(10);
 	}
 }
@@ -0,0 +1,71 @@
+#include <hellfire.h>
+#include <noc.h>
+#include <noc_rpc.h>
+
+#define ROUNDS		50
+
+int32_t procs[] = {1, 16, 64};
+
+int32_t echo(int8_t *in, int8_t *out)
+{
+	memcpy(out, in, sizeof(int32_t));
+
+	return 0;
+}
+
+/* the procedure lookup done by the RPC service before the procedure table, a walk on a list */
+struct proc_param_s *list_lookup(struct list *lst, uint32_t prognum, uint32_t procnum)
+{
+	struct proc_param_s *proc_param;
+	int32_t i, k;
+
+	k = hf_list_count(lst);
+	for (i = 0; i < k; i++) {
+		proc_param = hf_list_get(lst, i);
+		if (proc_param && proc_param->prognum == prognum && proc_param->procnum == procnum)
+			return proc_param;
+	}
+
+	return NULL;
+}
+
+/* registers procedures in steps, and times the lookup of the last registered procedure of each step */
+void bench(void)
+{
+	int32_t i, n = 0, k;
+	uint32_t cycles, list_cycles;
+	struct list *lst;
+
+	lst = hf_list_init();
+	if (!lst)
+		panic(0xff);
+
+	for (k = 0; k < sizeof(procs) / sizeof(int32_t); k++) {
+		for (; n < procs[k]; n++) {
+			hf_register(0, n, echo, sizeof(int32_t), sizeof(int32_t));
+			hf_list_append(lst, hf_lookup(0, n));
+		}
+
+		cycles = _readcounter();
+		for (i = 0; i < ROUNDS; i++)
+			if (!hf_lookup(0, n - 1))
+				printf("\nlookup failed");
+		cycles = _readcounter() - cycles;
+
+		list_cycles = _readcounter();
+		for (i = 0; i < ROUNDS; i++)
+			if (!list_lookup(lst, 0, n - 1))
+				printf("\nlookup failed");
+		list_cycles = _readcounter() - list_cycles;
+
+		printf("\n%d procedures: %d cycles per lookup (list: %d)", n, cycles / ROUNDS, list_cycles / ROUNDS);
+	}
+
+	hf_kill(hf_selfid());
+}
+
+void app_main(void)
+{
+	if (hf_cpuid() == 0)
+		hf_spawn(bench, 0, 0, 0, "bench", 2048);
+}
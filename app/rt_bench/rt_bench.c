@@ -0,0 +1,53 @@
+#include <hellfire.h>
+
+#define CALLS	100
+
+void rt_task(void){
+	for(;;){
+	}
+}
+
+/*
+ * for each set size, a fresh set of RT tasks is created with interrupts disabled, so the tasks never run
+ * before the measurement. task j of a set of n tasks has period and deadline n + 1 + j and a capacity of
+ * 2 ticks, so the heap keys are distinct, jobs complete and are released again during the measurement and
+ * the set is overloaded (utilization above 1), so there is always a ready job and all calls time the heap
+ * updates of a dispatch. the set is killed before interrupts are enabled again, so the RT time and jobs
+ * consumed by the measurement are discarded with it (this application has no other RT tasks).
+ */
+void bench(void){
+	int32_t i, j, n;
+	int16_t id[MAX_TASKS];
+	uint32_t status;
+	volatile uint32_t time;
+
+	printf("\nRT tasks, cycles per RT scheduler call");
+	for (n = 1; n < MAX_TASKS - 1; n++){
+		status = _di();
+		for (j = 0; j < n; j++){
+			id[j] = hf_spawn(rt_task, n + 1 + j, 2, n + 1 + j, "rt", 512);
+			if (id[j] < 0)
+				break;
+		}
+		if (j == n){
+			time = _readcounter();
+			for (i = 0; i < CALLS; i++)
+				krnl_pcb.sched_rt();
+			time = _readcounter() - time;
+			krnl_task = &krnl_tcb[krnl_current_task];
+		}
+		for (i = 0; i < j; i++)
+			hf_kill(id[i]);
+		_ei(status);
+
+		if (j < n)
+			break;
+		printf("\n%d, %d", n, time / CALLS);
+	}
+
+	hf_kill(hf_selfid());
+}
+
+void app_main(void){
+	hf_spawn(bench, 0, 0, 0, "bench", 2048);
+}
@@ -0,0 +1,55 @@
+#include <hellfire.h>
+
+#define ROUNDS		100
+#define BUSY_TASKS	4
+
+sem_t ping, pong;
+void (*post)(sem_t *s);
+
+void busy(void){
+	for(;;){
+	}
+}
+
+void pong_task(void){
+	for(;;){
+		hf_semwait(&ping);
+		post(&pong);
+	}
+}
+
+void ping_task(void){
+	int32_t i;
+	uint32_t cycles;
+
+	post = hf_sempost;
+	cycles = _readcounter();
+	for (i = 0; i < ROUNDS; i++){
+		post(&ping);
+		hf_semwait(&pong);
+	}
+	cycles = _readcounter() - cycles;
+	printf("\nhf_sempost(): %d cycles per round trip", cycles / ROUNDS);
+
+	post = hf_sempostyield;
+	cycles = _readcounter();
+	for (i = 0; i < ROUNDS; i++){
+		post(&ping);
+		hf_semwait(&pong);
+	}
+	cycles = _readcounter() - cycles;
+	printf("\nhf_sempostyield(): %d cycles per round trip", cycles / ROUNDS);
+
+	for(;;);
+}
+
+void app_main(void){
+	int32_t i;
+
+	hf_seminit(&ping, 0);
+	hf_seminit(&pong, 0);
+	hf_spawn(ping_task, 0, 0, 0, "ping", 1024);
+	hf_spawn(pong_task, 0, 0, 0, "pong", 1024);
+	for (i = 0; i < BUSY_TASKS; i++)
+		hf_spawn(busy, 0, 0, 0, "busy", 512);
+}
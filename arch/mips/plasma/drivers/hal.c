@@ -105,9 +105,49 @@ uint8_t switch_get(uint16_t sw)
 }
 
 /* hardware dependent basic kernel stuff */
+static uint32_t timer_lastcount = 0;
+
+#if TICKLESS == 1
+static uint8_t simulator = 0;
+
+/*
+ * tickless idle: if no task is ready, mask the timer and halt the core (simulator only)
+ * until the tick before the next kernel event. a pending NoC packet wakes the core earlier.
+ */
 void _cpu_idle(void)
 {
+	volatile uint32_t status;
+	uint32_t ticks, m, tick, wake, elapsed;
+
+	if (!simulator) return;
+
+	status = _di();
+	ticks = sched_idle_ticks();
+	if (ticks > 1){
+		if (ticks > (1 << (31 - TICK_TIME)))
+			ticks = 1 << (31 - TICK_TIME);
+		m = MemoryRead(IRQ_MASK);
+		MemoryWrite(IRQ_MASK, m & ~(IRQ_COUNTER18 | IRQ_COUNTER18_NOT));
+		tick = (_readcounter() | ((1 << TICK_TIME) - 1)) + 1;
+		wake = tick + ((ticks - 2) << TICK_TIME) + (1 << (TICK_TIME - 1));
+		MemoryWrite(SLEEP_REG, wake);
+
+		elapsed = _readcounter() - tick;
+		elapsed = ((int32_t)elapsed < 0) ? 0 : (elapsed >> TICK_TIME) + 1;
+		if (elapsed & 1)
+			m ^= (IRQ_COUNTER18 | IRQ_COUNTER18_NOT);
+		MemoryWrite(IRQ_MASK, m);
+		sched_idle_skip(elapsed);
+		timer_lastcount += ((uint64_t)elapsed << TICK_TIME) / (CPU_SPEED / 1000000);
+		_read_us();
+	}
+	_ei(status);
 }
+#else
+void _cpu_idle(void)
+{
+}
+#endif
 
 static void _idletask(void)
 {
@@ -121,6 +161,9 @@ void _hardware_init(void)
 	if(!(MemoryRead(LOG_FACILITY) != 0xa5a5a5a5)){						// detect if running on simulator
 		MemoryWrite(FREQUENCY_REG, CPU_SPEED);						// set MPSoC frequency register
 		MemoryWrite(TICK_TIME_REG, 1<<TICK_TIME);					// set tick time register
+#if TICKLESS == 1
+		simulator = 1;
+#endif
 	}
 	MemoryWrite(IRQ_MASK, 0);
 	ioports_init();
@@ -205,15 +248,15 @@ void *_get_task_tp(uint16_t task)
 
 void _timer_reset(void)
 {
-	static uint32_t timecount, lastcount = 0;
+	static uint32_t timecount;
 	uint32_t m;
 
 	m = MemoryRead(IRQ_MASK);						// read interrupt mask
 	m ^= (IRQ_COUNTER18 | IRQ_COUNTER18_NOT);				// toggle timer interrupt mask
 	MemoryWrite(IRQ_MASK, m);
 	timecount = _read_us();
-	krnl_pcb.tick_time = timecount - lastcount;
-	lastcount = timecount;
+	krnl_pcb.tick_time = timecount - timer_lastcount;
+	timer_lastcount = timecount;
 }
 
 uint32_t _readcounter(void)
@@ -2,6 +2,11 @@
 #define NOC_WRITE			0x20000080	/*WRITE*/
 #define NOC_STATUS			0x20000090	/*STATUS*/
 #define NOC_CTRL			0x200000C0	/*CONTROL*/
+#define NOC_DMA_CTRL			0x20000110	/*DMA ENABLE*/
+#define NOC_DMA_TX_RING			0x20000120	/*TX DESCRIPTOR RING*/
+#define NOC_DMA_RX_RING			0x20000130	/*RX DESCRIPTOR RING*/
+#define NOC_DMA_RING_SIZE		0x20000140	/*DESCRIPTORS PER RING*/
+#define NOC_DMA_STATUS			0x20000150	/*COMPLETION STATUS, CLEARED ON READ*/
 
 #define IRQ_NOC_READ			0x100
 
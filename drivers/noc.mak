@@ -1,5 +1,12 @@
+# network interface backend: hermes (flits moved by the cpu) or dma (descriptor rings)
+NOC_NI ?= hermes
+
+ifeq ($(NOC_NI),dma)
+CFLAGS += -DNOC_NI_DMA
+endif
+
 noc:
 	$(CC) $(CFLAGS) \
-		$(SRC_DIR)/drivers/noc/ni_hermes.c \
+		$(SRC_DIR)/drivers/noc/ni_$(NOC_NI).c \
 		$(SRC_DIR)/drivers/noc/noc.c \
 		$(SRC_DIR)/drivers/noc/noc_rpc.c
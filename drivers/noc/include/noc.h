@@ -32,16 +32,111 @@
 #define PKT_SEQ			6
 #define PKT_CHANNEL		7
 
+#define NOC_PAYLOAD_BYTES	((NOC_PACKET_SIZE - PKT_HEADER_SIZE) * sizeof(uint16_t))
+#define PKT_DATA(pkt)		((int8_t *)((pkt) + PKT_HEADER_SIZE))
+
+#define NOC_PORT_CREDIT		0xfffe
+#define NOC_PORT_ACK		0xfffd
+#define NOC_PORT_RESET		0xfffc
+#define NOC_PORT_CLOSE		0xfffb
+#define NOC_PORT_REFUSE		0xfffa
+
+/* slots of the pool kept out of the credits: control packets (credits, acknowledgements and resets) and packets lent by hf_pktalloc() */
+#ifndef NOC_CTRL_SLOTS
+#define NOC_CTRL_SLOTS		2
+#endif
+#ifndef NOC_LENT_SLOTS
+#define NOC_LENT_SLOTS		4
+#endif
+
+/* slots of the pool held by the network interface: the DMA backend keeps a packet on each descriptor of its RX ring */
+#ifdef NOC_NI_DMA
+#define NI_DMA_RING		8
+#define NOC_NI_SLOTS		NI_DMA_RING
+#else
+#define NOC_NI_SLOTS		0
+#endif
+#define NOC_CREDIT_SLOTS	(NOC_PACKET_SLOTS - NOC_CTRL_SLOTS - NOC_LENT_SLOTS - NOC_NI_SLOTS)
+
+/* credits (packets in flight) of a sender to each core. by default, the credited slots of the pool are split among all cores */
+#ifndef NOC_CREDITS
+#define NOC_CREDITS		(NOC_CREDIT_SLOTS / (NOC_WIDTH * NOC_HEIGHT))
+#endif
+#if NOC_CREDITS < 1 || NOC_CREDITS * NOC_WIDTH * NOC_HEIGHT > NOC_CREDIT_SLOTS
+#error "NOC_PACKET_SLOTS is too small: every core needs a credit, besides the control, lent and interface slots"
+#endif
+#define NOC_CREDIT_BATCH	((NOC_CREDITS + 1) / 2)
+
+/* reliable transport: messages in flight per task, retransmission timeout (ms), retries and streams per core */
+#ifndef NOC_WINDOW
+#define NOC_WINDOW		8
+#endif
+#ifndef NOC_RTO
+#define NOC_RTO			10
+#endif
+#ifndef NOC_RETRIES
+#define NOC_RETRIES		8
+#endif
+#ifndef NOC_STREAMS
+#define NOC_STREAMS		16
+#endif
+#define NOC_ACK_HEADER		6
+
+/* reassembly: age (ms) after which the fragments of an incomplete message are dropped */
+#ifndef NOC_REASM_AGE
+#define NOC_REASM_AGE		(4 * NOC_RTO)
+#endif
+
+/* statistics: packet drop reasons, latency histogram buckets (log2 of cycles >> NOC_LAT_SHIFT) and dump period (ms, 0 disables it) */
+#define NOC_DROP_HEADER		0		/*!< malformed packet or wrong target cpu */
+#define NOC_DROP_PORT		1		/*!< no task on the target port */
+#define NOC_DROP_POOL		2		/*!< no free packet on the pool */
+#define NOC_DROP_QUEUE		3		/*!< task queue full */
+#define NOC_DROP_SEQ		4		/*!< fragment out of range or duplicated */
+#define NOC_DROP_REASM		5		/*!< reassembly table full */
+#define NOC_DROP_STALE		6		/*!< fragment of an incomplete message evicted from reassembly */
+#define NOC_DROP_REASONS	7
+#ifndef NOC_LAT_BUCKETS
+#define NOC_LAT_BUCKETS		16
+#endif
+#define NOC_LAT_SHIFT		8
+#ifndef NOC_STATS_PERIOD
+#define NOC_STATS_PERIOD	0
+#endif
+
 #define NOC_COLUMN(core_n)	((core_n) % NOC_WIDTH)
 #define NOC_LINE(core_n)	((core_n) / NOC_WIDTH)
 
+/**
+ * @brief Traffic statistics of a port (or of the whole core, as port 0).
+ */
+struct noc_stats {
+	uint32_t packets_in;		/*!< packets received */
+	uint32_t packets_out;		/*!< packets sent */
+	uint32_t stalls;		/*!< times the sender ran out of credits */
+	uint32_t stall_time;		/*!< time blocked waiting for credits (us) */
+	uint32_t messages_in;		/*!< complete messages put on the task queue */
+	uint32_t drops[NOC_DROP_REASONS];	/*!< packets dropped, by reason */
+	uint16_t queue_hwm;		/*!< peak number of messages on the task queue */
+	uint16_t held_hwm;		/*!< peak number of packets held (messages and pending fragments) */
+	uint32_t latency[NOC_LAT_BUCKETS];	/*!< histogram of message latency (cycles), from the arrival of its first packet to its reception */
+};
+
+/**
+ * @brief Fragment of a message, for scatter-gather send and receive.
+ */
+struct noc_iovec {
+	int8_t *base;			/*!< fragment address */
+	uint16_t len;			/*!< fragment size (in bytes) */
+};
+
 /**
  * @brief Array of associations between tasks and reception ports.
  */
 uint16_t pktdrv_ports[MAX_TASKS];
 
 /**
- * @brief Array of queues. Each task can have its own custom sized queue.
+ * @brief Array of queues of complete messages (first fragment of each). Each task can have its own custom sized queue.
  */
 struct queue *pktdrv_tqueue[MAX_TASKS];
 
@@ -51,20 +146,36 @@ struct queue *pktdrv_tqueue[MAX_TASKS];
 struct queue *pktdrv_queue;
 
 /**
- * @brief Callback function pointer. Called when PKT_TARGET_PORT is 0xffff.
+ * @brief Callback function pointer. Called when PKT_TARGET_PORT is 0xffff. Returns ERR_OK when it keeps the packet.
  */
 int32_t (*pktdrv_callback)(uint16_t *buf);
 
 void ni_init(void);
 void ni_isr(void *arg);
+void ni_wakeup(uint16_t id, uint16_t channel);
+int32_t ni_deliver(uint16_t id, uint16_t *buf_ptr);
 
 uint16_t hf_cpuid(void);
 uint16_t hf_ncores(void);
 int32_t hf_comm_create(uint16_t id, uint16_t port, uint16_t packets);
 int32_t hf_comm_destroy(uint16_t id);
 int32_t hf_recvprobe(void);
+int32_t hf_recvwait(void);
 int32_t hf_recv(uint16_t *source_cpu, uint16_t *source_port, int8_t *buf, uint16_t *size, uint16_t channel);
 int32_t hf_send(uint16_t target_cpu, uint16_t target_port, int8_t *buf, uint16_t size, uint16_t channel);
+int32_t hf_sendv(uint16_t target_cpu, uint16_t target_port, struct noc_iovec *iov, uint16_t iovcnt, uint16_t channel);
+int32_t hf_recvv(uint16_t *source_cpu, uint16_t *source_port, struct noc_iovec *iov, uint16_t iovcnt, uint16_t *size, uint16_t channel);
+int32_t hf_multicast(uint16_t first_cpu, uint16_t last_cpu, uint16_t target_port, int8_t *buf, uint16_t size, uint16_t channel);
+int32_t hf_broadcast(uint16_t target_port, int8_t *buf, uint16_t size, uint16_t channel);
+uint16_t *hf_pktalloc(uint16_t size);
+void hf_pktfree(uint16_t *pkt);
+uint16_t *hf_pktnext(uint16_t *pkt);
+int32_t hf_sendpkt(uint16_t target_cpu, uint16_t target_port, uint16_t *pkt, uint16_t size, uint16_t channel);
+int32_t hf_recvpkt(uint16_t *source_cpu, uint16_t *source_port, uint16_t **pkt, uint16_t *size, uint16_t channel);
+int32_t hf_credits(uint16_t target_cpu);
+int32_t hf_nocstats(uint16_t port, struct noc_stats *stats);
+void hf_nocstats_dump(void);
 int32_t hf_recvack(uint16_t *source_cpu, uint16_t *source_port, int8_t *buf, uint16_t *size, uint16_t channel);
 int32_t hf_sendack(uint16_t target_cpu, uint16_t target_port, int8_t *buf, uint16_t size, uint16_t channel, uint32_t timeout);
+int32_t hf_ackwait(uint32_t timeout);
 // hf_request(), hf_reply()
@@ -18,13 +18,28 @@
 
 #define RPC_MAX_PARAM_SIZE	1024
 #define RPC_MAX_PARALLEL_CALLS	20
+#define RPC_MAX_BATCH		32
 #define RPC_STACK_SIZE		2048
 #define RPC_SCHANNEL		65534
 #define RPC_PORT		65535
+#define RPC_ACHANNEL		65000
+#define RPC_WPORT		65400
+
+#ifndef RPC_WORKERS
+#define RPC_WORKERS		2
+#endif
+
+/* size of the procedure table (power of two) */
+#ifndef RPC_PROC_SLOTS
+#define RPC_PROC_SLOTS		128
+#endif
 
 struct noc_rpc_s {
 	uint16_t thread_id;
-	struct list *proc_list;
+	uint16_t workers[RPC_WORKERS];
+	struct proc_param_s *proc_table[RPC_PROC_SLOTS];
+	struct queue *jobs;
+	sem_t pending;
 };
 
 struct noc_rpc_s noc_rpcdrv;
@@ -35,8 +50,6 @@ struct proc_param_s {
 	int32_t (*proc_ptr)(int8_t *, int8_t *);
 	uint16_t in_size;
 	uint16_t out_size;
-	int8_t *in_data;
-	int8_t *out_data;
 };
 
 struct proc_pkt_s {
@@ -45,6 +58,23 @@ struct proc_pkt_s {
 	uint16_t in_size;
 	uint16_t out_size;
 	int32_t ecode;
+	uint16_t call_id;
+	uint16_t records;
+};
+
+struct proc_rec_s {
+	uint32_t prognum;
+	uint32_t procnum;
+	uint16_t size;
+	int16_t ecode;
+};
+
+struct rpc_call_s {
+	uint16_t call_id;
+	uint16_t task_id;
+	uint16_t cpu;
+	uint16_t out_size;
+	int8_t *out_data;
 };
 
 union proc_pkt_u {
@@ -52,9 +82,27 @@ union proc_pkt_u {
 	int8_t proc_data[sizeof(struct proc_pkt_s) + RPC_MAX_PARAM_SIZE];
 };
 
+struct rpc_batch_s {
+	union proc_pkt_u proc_pkt;
+	uint16_t records;
+	uint16_t in_size;
+	uint16_t out_size;
+	uint16_t rec_size[RPC_MAX_BATCH];
+	int8_t *rec_data[RPC_MAX_BATCH];
+	int32_t ecode[RPC_MAX_BATCH];
+};
+
+#define RPC_REC_ALIGN(size)	(((size) + 3) & ~3)
+
 mutex_t rpc_lock;
 
 int32_t hf_register(uint32_t prognum, uint32_t procnum, int32_t (*pname)(int8_t *, int8_t *), uint16_t in_size, uint16_t out_size);
+struct proc_param_s *hf_lookup(uint32_t prognum, uint32_t procnum);
 int32_t hf_call(uint16_t cpu, uint32_t prognum, uint32_t procnum, int8_t *in, uint16_t in_size, int8_t *out, uint16_t out_size);
+int32_t hf_call_async(uint16_t cpu, uint32_t prognum, uint32_t procnum, int8_t *in, uint16_t in_size, int8_t *out, uint16_t out_size);
+int32_t hf_wait(int32_t handle);
+void hf_batch_init(struct rpc_batch_s *batch);
+int32_t hf_batch_add(struct rpc_batch_s *batch, uint32_t prognum, uint32_t procnum, int8_t *in, uint16_t in_size, int8_t *out, uint16_t out_size);
+int32_t hf_call_batch(uint16_t cpu, struct rpc_batch_s *batch);
 
 #endif
@@ -0,0 +1,168 @@
+/**
+ * @file ni_dma.c
+ *
+ * @section LICENSE
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file 'doc/license/gpl-2.0.txt' for more details.
+ *
+ * @section DESCRIPTION
+ *
+ * Network interface driver for a DMA capable interface attached to an Hermes NoC.
+ * This driver works with 16-bit flits. Packets are moved between memory and the network
+ * by the interface, following two rings of descriptors (TX and RX) kept in memory, and
+ * a completion interrupt (IRQ_NOC_READ) is raised when packets are received.
+ *
+ * Descriptor format is as follows:
+ *
+ \verbatim
+  4 bytes        4 bytes
+ ------------------------------------------
+ |buffer addr  |own (bit 31) | length    |
+ ------------------------------------------
+ \endverbatim
+ *
+ * A descriptor with the own bit set belongs to the interface. Once a packet is sent (TX)
+ * or received (RX) the interface clears the own bit. Packets are variable sized: the length
+ * of a TX descriptor is the size of the packet (in flits) and the interface writes the size
+ * of each received packet (taken from its payload flit) back to the RX descriptor. RX descriptors point to packets of
+ * the shared pool, which are exchanged with empty packets by ni_swap_packet(), so received
+ * packets are not copied.
+ */
+
+#include <hellfire.h>
+#include <ni.h>
+#include <noc.h>
+
+#ifndef NOC_NI_DMA
+#error "ni_dma.c is the DMA backend: build it with NOC_NI = dma, so its RX ring is kept out of the credits"
+#endif
+
+#define NI_DMA_OWN		0x80000000
+
+struct ni_dma_desc {
+	uint32_t addr;
+	uint32_t ctrl;
+};
+
+static volatile struct ni_dma_desc tx_ring[NI_DMA_RING], rx_ring[NI_DMA_RING];
+static uint16_t *tx_buf[NI_DMA_RING], *rx_buf[NI_DMA_RING];
+static volatile uint8_t tx_busy[NI_DMA_RING];
+static int32_t tx_tail, rx_head, dma_up = 0;
+
+/* sets up both rings. RX buffers are taken from the packet driver pool */
+static int32_t ni_dma_init(uint16_t pkt_size)
+{
+	int32_t i;
+
+	for (i = 0; i < NI_DMA_RING; i++){
+		tx_buf[i] = hf_malloc(sizeof(uint16_t) * pkt_size);
+		rx_buf[i] = hf_queue_remhead(pktdrv_queue);
+		if (tx_buf[i] == NULL || rx_buf[i] == NULL)
+			return 0;
+
+		tx_busy[i] = 0;
+		tx_ring[i].addr = (uint32_t)tx_buf[i];
+		tx_ring[i].ctrl = 0;
+		rx_ring[i].addr = (uint32_t)rx_buf[i];
+		rx_ring[i].ctrl = NI_DMA_OWN | pkt_size;
+	}
+	tx_tail = 0;
+	rx_head = 0;
+
+	MemoryWrite(NOC_DMA_TX_RING, (uint32_t)tx_ring);
+	MemoryWrite(NOC_DMA_RX_RING, (uint32_t)rx_ring);
+	MemoryWrite(NOC_DMA_RING_SIZE, NI_DMA_RING);
+	MemoryWrite(NOC_DMA_CTRL, 1);
+	dma_up = 1;
+
+	return 1;
+}
+
+int32_t ni_ready(void)
+{
+	return !tx_busy[tx_tail] && !(tx_ring[tx_tail].ctrl & NI_DMA_OWN);
+}
+
+int32_t ni_flush(uint16_t pkt_size)
+{
+	uint32_t status;
+
+	if (!dma_up)
+		return ni_dma_init(pkt_size);
+
+	status = _di();
+	MemoryRead(NOC_DMA_STATUS);
+	if (!(rx_ring[rx_head].ctrl & NI_DMA_OWN)){
+		rx_ring[rx_head].ctrl = NI_DMA_OWN | pkt_size;
+		rx_head = (rx_head + 1) % NI_DMA_RING;
+	}
+	_ei(status);
+
+	return ni_ready();
+}
+
+int32_t ni_read_packet(uint16_t *buf, uint16_t pkt_size)
+{
+	uint32_t status, len;
+
+	status = _di();
+	MemoryRead(NOC_DMA_STATUS);
+	if (rx_ring[rx_head].ctrl & NI_DMA_OWN){
+		_ei(status);
+		return -1;
+	}
+	len = rx_ring[rx_head].ctrl & 0xffff;
+	memcpy(buf, rx_buf[rx_head], sizeof(uint16_t) * (len < pkt_size ? len : pkt_size));
+	rx_ring[rx_head].ctrl = NI_DMA_OWN | pkt_size;
+	rx_head = (rx_head + 1) % NI_DMA_RING;
+	_ei(status);
+
+	return 0;
+}
+
+int32_t ni_write_packet(uint16_t *buf, uint16_t pkt_size)
+{
+	uint32_t status;
+	int32_t slot;
+
+retry:
+	while (!ni_ready());
+	status = _di();
+	if (!ni_ready()) {
+		_ei(status);
+		goto retry;
+	}
+	slot = tx_tail;
+	tx_busy[slot] = 1;
+	tx_tail = (tx_tail + 1) % NI_DMA_RING;
+	_ei(status);
+
+	memcpy(tx_buf[slot], buf, sizeof(uint16_t) * pkt_size);
+	tx_ring[slot].ctrl = NI_DMA_OWN | pkt_size;
+	tx_busy[slot] = 0;
+
+	return 0;
+}
+
+uint16_t *ni_swap_packet(uint16_t *buf, uint16_t pkt_size)
+{
+	uint16_t *pkt;
+
+	MemoryRead(NOC_DMA_STATUS);
+	if (rx_ring[rx_head].ctrl & NI_DMA_OWN)
+		return NULL;
+
+	pkt = rx_buf[rx_head];
+	rx_buf[rx_head] = buf;
+	rx_ring[rx_head].addr = (uint32_t)buf;
+	rx_ring[rx_head].ctrl = NI_DMA_OWN | pkt_size;
+	rx_head = (rx_head + 1) % NI_DMA_RING;
+
+	return pkt;
+}
+
+int32_t ni_rx_pending(void)
+{
+	return !(rx_ring[rx_head].ctrl & NI_DMA_OWN);
+}
@@ -23,6 +23,8 @@
  --------------------------------------
  \endverbatim
  *
+ * Packets are variable sized. The payload flit holds the number of flits that follow it, so only
+ * the flits of the packet are moved to or from the interface.
  */
 
 #include <hellfire.h>
@@ -36,26 +38,34 @@ int32_t ni_ready(void)
 int32_t ni_flush(uint16_t pkt_size)
 {
 	uint32_t status;
-	int32_t i;
+	int32_t i, flits;
 
 	status = _di();
 	_ni_read();
-	for(i = 0; i < pkt_size; i++)
+	_ni_read();
+	flits = _ni_read();
+	for (i = 0; i < flits; i++)
 		_ni_read();
 	_ei(status);
 
 	return ni_ready();
 }
 
+/* reads a packet, up to pkt_size flits. flits of a larger packet are discarded */
 int32_t ni_read_packet(uint16_t *buf, uint16_t pkt_size)
 {
 	uint32_t status;
-	int32_t i;
+	int32_t i, flits;
 
 	status = _di();
 	_ni_read();
-	for (i = 0; i < pkt_size; i++)
+	buf[0] = _ni_read();
+	buf[1] = _ni_read();
+	flits = buf[1] + 2;
+	for (i = 2; i < flits && i < pkt_size; i++)
 		buf[i] = _ni_read();
+	for (; i < flits; i++)
+		_ni_read();
 	_ei(status);
 	return 0;
 }
@@ -78,3 +88,15 @@ retry:
 
 	return 0;
 }
+
+uint16_t *ni_swap_packet(uint16_t *buf, uint16_t pkt_size)
+{
+	ni_read_packet(buf, pkt_size);
+
+	return buf;
+}
+
+int32_t ni_rx_pending(void)
+{
+	return 0;
+}
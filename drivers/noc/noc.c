@@ -26,6 +26,10 @@
  --------------------------------------------------------------------------------------------------
  \endverbatim
  *
+ * The payload field holds the number of flits that follow it, so packets are variable sized: each
+ * packet carries only the header and the data of its fragment (the last fragment of a message and
+ * control packets are short), up to NOC_PACKET_SIZE flits.
+ *
  * The platform should include the following macros:
  *
  * NOC_INTERCONNECT			intra-chip interconnection type
@@ -41,6 +45,142 @@
 #include <ni.h>
 #include <ni_generic.h>
 
+#define NI_WAIT_NONE		-1
+#define NI_WAIT_ANY		-2
+#define NI_WAIT_CREDIT		-3
+#define NI_WAIT_ACK		-4
+
+/**
+ * @brief Reception wait objects. Channel a task is blocked on (waiting for a packet), NI_WAIT_ANY
+ * if any packet unblocks the task, NI_WAIT_CREDIT or NI_WAIT_ACK if the task waits for credits or
+ * for room on its window of messages in flight and NI_WAIT_NONE if the task is not waiting.
+ */
+static int32_t pktdrv_wait[MAX_TASKS];
+
+/* link to the next fragment of a message, kept after the packet flits */
+#define PKT_LINK(buf)		(*(uint16_t **)((buf) + NOC_PACKET_SIZE))
+#define NI_FLITS(bytes)		(PKT_HEADER_SIZE + ((bytes) + 1) / 2)
+#define PKT_TIME(buf)		(*(uint32_t *)((int8_t *)((buf) + NOC_PACKET_SIZE) + sizeof(uint16_t *)))
+
+#define NI_REASM_SLOTS		64
+#define NI_REASM_AGE		((uint32_t)NOC_REASM_AGE * (CPU_SPEED / 1000))
+
+/**
+ * @brief Reassembly entry. Holds the fragments of a message (identified by target task, source cpu,
+ * source port and channel) which are still arriving, linked in sequence order.
+ */
+struct ni_reasm {
+	struct ni_reasm *next;		/*!< next entry on the hash chain (or free list) */
+	uint16_t *head;			/*!< first fragment of the message */
+	uint16_t *tail;			/*!< last fragment of the message */
+	uint16_t id;			/*!< target task */
+	uint16_t source_cpu;		/*!< source cpu */
+	uint16_t source_port;		/*!< source port */
+	uint16_t channel;		/*!< message channel */
+	uint16_t packets;		/*!< fragments of the message */
+	uint16_t received;		/*!< fragments received so far */
+	uint32_t time;			/*!< arrival of the first fragment (cycles), evicted after NOC_REASM_AGE ms */
+};
+
+/**
+ * @brief Reassembly table. Each pending entry holds at least one packet from the pool, so there are
+ * never more than NOC_PACKET_SLOTS entries in use.
+ */
+static struct ni_reasm pktdrv_reasm[NOC_PACKET_SLOTS];
+static struct ni_reasm *pktdrv_reasm_free;
+static struct ni_reasm *pktdrv_reasm_hash[NI_REASM_SLOTS];
+
+/**
+ * @brief Number of packets (complete messages and pending fragments) held by each task.
+ */
+static uint16_t pktdrv_frags[MAX_TASKS];
+
+/**
+ * @brief Flow control. Credits (packets that may be sent) to each core and packets consumed from each
+ * core not yet given back as credits to it. While the interrupt handler runs, pktdrv_isr is set, and it
+ * is set to 2 when a packet is freed (dropped), so the handler gives those credits back itself.
+ */
+static uint16_t pktdrv_credits[NOC_WIDTH * NOC_HEIGHT];
+static uint16_t pktdrv_pending[NOC_WIDTH * NOC_HEIGHT];
+static uint16_t pktdrv_isr;
+
+/**
+ * @brief Packets lent by hf_pktalloc(), up to NOC_LENT_SLOTS, and a packet read aside when the pool is empty.
+ */
+static uint16_t pktdrv_lent;
+static uint16_t pktdrv_aside[NOC_PACKET_SIZE];
+
+/**
+ * @brief Traffic statistics of each task (port). The last entry holds drops not related to a port.
+ * Each counter has a single writer (the interrupt handler on reception, the task on transmission),
+ * so counters are updated and read without disabling interrupts.
+ */
+static struct noc_stats pktdrv_nstats[MAX_TASKS + 1];
+static uint16_t pktdrv_stats_task;
+
+/* sequence number a is before b (modulo 2^16) */
+#define NI_SEQ_LT(a, b)		((int16_t)((a) - (b)) < 0)
+
+/**
+ * @brief Reliable transport stream. Identified by the local task and the remote (cpu, port, channel).
+ * On the sender, seq is the next sequence number to be used and acked / sack hold the last acknowledgement
+ * (cumulative sequence and a bitmap of messages held by the receiver after acked + 1). On the receiver,
+ * seq is the next sequence number expected. Free entries have port 0. A sender reclaims an idle stream (all
+ * messages acknowledged) when its table is full, telling the receiver to forget it, and a receiver without
+ * room for a new stream refuses its messages, so the sender drops them instead of retransmitting.
+ */
+struct ni_stream {
+	uint16_t id;			/*!< local task */
+	uint16_t cpu;			/*!< remote cpu */
+	uint16_t port;			/*!< remote port */
+	uint16_t channel;		/*!< message channel */
+	uint16_t seq;			/*!< next sequence number (to be sent or expected) */
+	uint16_t acked;			/*!< last cumulative acknowledgement */
+	uint16_t sack;			/*!< selective acknowledgement bitmap */
+	uint16_t refused;		/*!< the receiver had no room for the stream */
+};
+
+/**
+ * @brief Message in flight (sent with hf_sendack(), not acknowledged yet). A copy of the message is kept
+ * for retransmission. Free slots have no buffer.
+ */
+struct ni_window {
+	struct ni_stream *stream;	/*!< stream of the message */
+	int8_t *buf;			/*!< message, including the transport header */
+	uint32_t time;			/*!< time of the last transmission (us) */
+	uint16_t size;			/*!< message size, including the transport header */
+	uint16_t seq;			/*!< sequence number */
+	uint16_t retries;		/*!< retransmissions */
+	uint16_t busy;			/*!< the message is being sent (not to be released) */
+};
+
+static struct ni_stream pktdrv_tx[NOC_STREAMS];
+static struct ni_stream pktdrv_rx[NOC_STREAMS];
+static struct ni_window *pktdrv_window[MAX_TASKS];
+static int32_t pktdrv_ackerr[MAX_TASKS];
+static uint16_t pktdrv_xport_task;
+
+static void ni_unblock(uint16_t id);
+static void ni_credit_flush(uint16_t min);
+static void ni_ack_rx(uint16_t *buf_ptr);
+static void ni_reset_rx(uint16_t *buf_ptr);
+static void ni_close_rx(uint16_t *buf_ptr);
+static void ni_refuse_rx(uint16_t *buf_ptr);
+static int32_t ni_reasm_expire(void);
+static int32_t ni_sendv(uint16_t id, uint16_t target_cpu, uint16_t target_port, struct noc_iovec *iov, uint16_t iovcnt, uint16_t channel);
+static void ni_transport_task(void);
+
+/* returns a received packet to the pool, giving a credit back to its sender. called with interrupts disabled */
+static void ni_free(uint16_t *buf_ptr)
+{
+	if (buf_ptr[PKT_SOURCE_CPU] < NOC_WIDTH * NOC_HEIGHT){
+		pktdrv_pending[buf_ptr[PKT_SOURCE_CPU]]++;
+		if (pktdrv_isr)
+			pktdrv_isr = 2;
+	}
+	hf_queue_addtail(pktdrv_queue, buf_ptr);
+}
+
 /**
  * @brief NoC driver: initializes the network interface.
  *
@@ -61,11 +201,42 @@ void ni_init(void)
 	pktdrv_queue = hf_queue_create(NOC_PACKET_SLOTS);
 	if (pktdrv_queue == NULL) panic(PANIC_OOM);
 
-	for (i = 0; i < MAX_TASKS; i++)
+	for (i = 0; i < MAX_TASKS; i++){
 		pktdrv_ports[i] = 0;
+		pktdrv_wait[i] = NI_WAIT_NONE;
+		pktdrv_frags[i] = 0;
+	}
+
+	pktdrv_reasm_free = NULL;
+	for (i = 0; i < NOC_PACKET_SLOTS; i++){
+		pktdrv_reasm[i].next = pktdrv_reasm_free;
+		pktdrv_reasm_free = &pktdrv_reasm[i];
+	}
+	for (i = 0; i < NI_REASM_SLOTS; i++)
+		pktdrv_reasm_hash[i] = NULL;
+
+	for (i = 0; i < NOC_WIDTH * NOC_HEIGHT; i++){
+		pktdrv_credits[i] = NOC_CREDITS;
+		pktdrv_pending[i] = 0;
+	}
+	pktdrv_isr = 0;
+	pktdrv_lent = 0;
+
+	for (i = 0; i < NOC_STREAMS; i++){
+		pktdrv_tx[i].port = 0;
+		pktdrv_rx[i].port = 0;
+	}
+	for (i = 0; i < MAX_TASKS; i++){
+		pktdrv_window[i] = NULL;
+		pktdrv_ackerr[i] = ERR_OK;
+	}
+	pktdrv_xport_task = 0;
+
+	memset(pktdrv_nstats, 0, sizeof(pktdrv_nstats));
+	pktdrv_stats_task = 0;
 
 	for (i = 0; i < NOC_PACKET_SLOTS; i++){
-		ptr = hf_malloc(sizeof(int16_t) * NOC_PACKET_SIZE);
+		ptr = hf_malloc(sizeof(int16_t) * NOC_PACKET_SIZE + sizeof(uint16_t *) + sizeof(uint32_t));
 		if (ptr == NULL) panic(PANIC_OOM);
 		hf_queue_addtail(pktdrv_queue, ptr);
 	}
@@ -80,71 +251,605 @@ void ni_init(void)
 	}
 }
 
+/* the packet header is well formed and the packet is for this core */
+static int32_t ni_rx_valid(uint16_t *buf_ptr)
+{
+	return buf_ptr[PKT_PAYLOAD] >= PKT_HEADER_SIZE - 2 && buf_ptr[PKT_PAYLOAD] <= NOC_PACKET_SIZE - 2 &&
+		buf_ptr[PKT_TARGET_CPU] == ((NOC_COLUMN(CPU_ID) << 4) | NOC_LINE(CPU_ID));
+}
+
+/* takes a control packet (credits, acknowledgement or reset), which is not credited. returns 0 for other packets. called with interrupts disabled */
+static int32_t ni_rx_ctrl(uint16_t *buf_ptr)
+{
+	int32_t k;
+
+	switch (buf_ptr[PKT_TARGET_PORT]) {
+	case NOC_PORT_CREDIT:
+		if (buf_ptr[PKT_SOURCE_CPU] < NOC_WIDTH * NOC_HEIGHT){
+			pktdrv_credits[buf_ptr[PKT_SOURCE_CPU]] += buf_ptr[PKT_HEADER_SIZE];
+			for (k = 0; k < MAX_TASKS; k++)
+				if (pktdrv_wait[k] == NI_WAIT_CREDIT)
+					ni_unblock(k);
+		}
+		return 1;
+	case NOC_PORT_ACK:
+		ni_ack_rx(buf_ptr);
+		return 1;
+	case NOC_PORT_RESET:
+		ni_reset_rx(buf_ptr);
+		return 1;
+	case NOC_PORT_CLOSE:
+		ni_close_rx(buf_ptr);
+		return 1;
+	case NOC_PORT_REFUSE:
+		ni_refuse_rx(buf_ptr);
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * takes a packet read aside while the pool is empty. control packets are still taken, other packets are dropped
+ * and their credit is given back, so the sender does not lose it. called with interrupts disabled
+ */
+static void ni_rx_aside(uint16_t *buf_ptr)
+{
+	if (ni_rx_valid(buf_ptr) && ni_rx_ctrl(buf_ptr))
+		return;
+
+	pktdrv_nstats[MAX_TASKS].drops[ni_rx_valid(buf_ptr) ? NOC_DROP_POOL : NOC_DROP_HEADER]++;
+	if (buf_ptr[PKT_SOURCE_CPU] < NOC_WIDTH * NOC_HEIGHT){
+		pktdrv_pending[buf_ptr[PKT_SOURCE_CPU]]++;
+		pktdrv_isr = 2;
+	}
+}
+
+/* decodes a received packet and passes it to its target. called with interrupts disabled */
+static void ni_rx_packet(uint16_t *buf_ptr)
+{
+	int32_t k;
+
+	if (!ni_rx_valid(buf_ptr)){
+		pktdrv_nstats[MAX_TASKS].drops[NOC_DROP_HEADER]++;
+		ni_free(buf_ptr);
+		return;
+	}
+
+	if (ni_rx_ctrl(buf_ptr)){
+		hf_queue_addtail(pktdrv_queue, buf_ptr);
+		return;
+	}
+
+	switch (buf_ptr[PKT_TARGET_PORT]) {
+	case 0x0000:
+		ni_free(buf_ptr);
+		return;
+	case 0xffff:
+		if (pktdrv_callback == NULL || pktdrv_callback(buf_ptr) != ERR_OK)
+			ni_free(buf_ptr);
+		return;
+	default:
+		break;
+	}
+
+	for (k = 0; k < MAX_TASKS; k++)
+		if (pktdrv_ports[k] == buf_ptr[PKT_TARGET_PORT]) break;
+
+	if (k < MAX_TASKS && krnl_tcb[k].ptask && pktdrv_tqueue[k]){
+		ni_deliver(k, buf_ptr);
+	}else{
+		pktdrv_nstats[MAX_TASKS].drops[NOC_DROP_PORT]++;
+		ni_free(buf_ptr);
+	}
+}
+
 /**
  * @brief NoC driver: network interface interrupt service routine.
  *
  * This routine is called by the second level of interrupt handling. An interrupt from the network
- * interface means a full packet has arrived. The packet header is decoded and the target port is
- * identified. A reference to an empty packet is removed from the pool of buffers (packets), the
- * contents of the empty packet are filled with flits from the hardware queue and the reference is
- * put on the target task (associated to a port) queue of packets. There is one queue per task of
+ * interface means a full packet (or several packets, with a DMA interface) has arrived. A reference
+ * to an empty packet is removed from the pool of buffers (packets) and exchanged by the network
+ * interface backend for a received packet (filled with flits from the hardware queue, or written
+ * by DMA). The packet header is decoded, the target port is identified and the reference is
+ * passed to ni_deliver(), which places it on the reassembly table of the target task (associated to
+ * a port). Complete messages are put on the task queue of messages. There is one queue per task of
  * configurable size (individual queues are elastic if size is zero, limited to the size of free
  * buffer elements from the common pool). If port 0xffff (65535) is used as the target, the packet
  * is passed to a callback. This mechanism can be used to build custom OS functions (such as user
  * defined protocols, RPC or remote system calls). Port 0 is used as a discard function, for testing
- * purposes.
+ * purposes. Port 0xfffe carries flow control credits from other cores, and tasks blocked waiting
+ * for credits are unblocked. Ports 0xfffd to 0xfffa carry acknowledgements, reassembly resets, stream
+ * closes and refusals of the reliable transport. If the target task is blocked waiting for a message on the channel of the packet, it is
+ * unblocked when the message is complete. The callback returns ERR_OK when it keeps the packet,
+ * otherwise the packet is returned to the pool. Slots of the pool are reserved for control packets, and if
+ * the pool is still empty the packet is read aside: control packets are taken and other packets are dropped.
+ * Credits of dropped packets are given back to their senders before returning, as no task may be
+ * running on this core to do it.
  */
 void ni_isr(void *arg)
 {
-	int32_t k;
-	uint16_t *buf_ptr;
+	uint16_t *buf_ptr, *pkt;
 
-	buf_ptr = hf_queue_remhead(pktdrv_queue);
-	if (buf_ptr) {
-		ni_read_packet(buf_ptr, NOC_PACKET_SIZE);
+	pktdrv_isr = 1;
+	do {
+		buf_ptr = hf_queue_remhead(pktdrv_queue);
+		if (buf_ptr == NULL && ni_reasm_expire())
+			buf_ptr = hf_queue_remhead(pktdrv_queue);
+		if (buf_ptr){
+			pkt = ni_swap_packet(buf_ptr, NOC_PACKET_SIZE);
+			if (pkt == NULL){
+				hf_queue_addtail(pktdrv_queue, buf_ptr);
+				break;
+			}
+			ni_rx_packet(pkt);
+		}else{
+			if (ni_read_packet(pktdrv_aside, NOC_PACKET_SIZE))
+				break;
+			ni_rx_aside(pktdrv_aside);
+		}
+	} while (ni_rx_pending());
 
-		if (buf_ptr[PKT_PAYLOAD] != NOC_PACKET_SIZE - 2){
-			hf_queue_addtail(pktdrv_queue, buf_ptr);
-			return;
+	if (pktdrv_isr == 2)
+		ni_credit_flush(1);
+	pktdrv_isr = 0;
+}
+
+/**
+ * @brief NoC driver: unblocks a task waiting for a packet.
+ *
+ * @param id is the task id which owns the communication queue
+ * @param channel is the channel of the packet just put on the task queue
+ *
+ * Must be called with interrupts disabled (e.g. from ni_isr() or a packet driver callback), after a
+ * packet is put on the task queue. If the task is blocked on hf_recv() (or hf_recvwait()) waiting for
+ * a packet on this channel, it is put back on its run queue.
+ */
+void ni_wakeup(uint16_t id, uint16_t channel)
+{
+	if (pktdrv_wait[id] == NI_WAIT_NONE || pktdrv_wait[id] == NI_WAIT_CREDIT || pktdrv_wait[id] == NI_WAIT_ACK)
+		return;
+	if (pktdrv_wait[id] != NI_WAIT_ANY && pktdrv_wait[id] != channel)
+		return;
+
+	ni_unblock(id);
+}
+
+/* puts a task blocked on the driver back on its run queue. called with interrupts disabled */
+static void ni_unblock(uint16_t id)
+{
+	struct tcb_entry *krnl_task2;
+
+	pktdrv_wait[id] = NI_WAIT_NONE;
+	krnl_task2 = &krnl_tcb[id];
+	if (krnl_task2->state == TASK_BLOCKED){
+		krnl_task2->state = TASK_READY;
+		sched_ready_add(krnl_task2);
+	}
+}
+
+/* blocks the calling task until ni_wakeup() is called for the channel. called with interrupts disabled */
+static void ni_block(uint16_t id, int32_t channel, uint32_t *status)
+{
+	struct tcb_entry *krnl_task2;
+
+	krnl_task2 = &krnl_tcb[id];
+	pktdrv_wait[id] = channel;
+	krnl_task2->state = TASK_BLOCKED;
+	sched_ready_rem(krnl_task2);
+	_ei(*status);
+	hf_yield();
+	*status = _di();
+}
+
+/*
+ * gives back credits for consumed packets to their senders, when at least min credits are pending for a core.
+ * called from tasks and from the interrupt handler
+ */
+static void ni_credit_flush(uint16_t min)
+{
+	uint16_t out_buf[NI_FLITS(sizeof(uint16_t))];
+	uint32_t status;
+	int32_t i;
+	uint16_t credits;
+
+	for (i = 0; i < NOC_WIDTH * NOC_HEIGHT; i++){
+		if (pktdrv_pending[i] == 0 || pktdrv_pending[i] < min)
+			continue;
+
+		status = _di();
+		credits = pktdrv_pending[i];
+		pktdrv_pending[i] = 0;
+		_ei(status);
+
+		out_buf[PKT_TARGET_CPU] = (NOC_COLUMN(i) << 4) | NOC_LINE(i);
+		out_buf[PKT_PAYLOAD] = NI_FLITS(sizeof(uint16_t)) - 2;
+		out_buf[PKT_SOURCE_CPU] = hf_cpuid();
+		out_buf[PKT_SOURCE_PORT] = NOC_PORT_CREDIT;
+		out_buf[PKT_TARGET_PORT] = NOC_PORT_CREDIT;
+		out_buf[PKT_MSG_SIZE] = sizeof(uint16_t);
+		out_buf[PKT_SEQ] = 1;
+		out_buf[PKT_CHANNEL] = 0;
+		out_buf[PKT_HEADER_SIZE] = credits;
+
+		ni_write_packet(out_buf, NI_FLITS(sizeof(uint16_t)));
+	}
+}
+
+/*
+ * takes a credit to send a packet of task id to a core, blocking the calling task while there are no credits.
+ * the calling task is not the sender when the transport task retransmits a message on its behalf
+ */
+static void ni_credit_take(uint16_t id, uint16_t target_cpu)
+{
+	uint32_t status, time;
+
+	status = _di();
+	if (pktdrv_credits[target_cpu] == 0){
+		pktdrv_nstats[id].stalls++;
+		time = _read_us();
+		while (pktdrv_credits[target_cpu] == 0){
+			_ei(status);
+			ni_credit_flush(1);
+			status = _di();
+			if (pktdrv_credits[target_cpu])
+				break;
+			ni_block(hf_selfid(), NI_WAIT_CREDIT, &status);
+		}
+		pktdrv_nstats[id].stall_time += _read_us() - time;
+	}
+	pktdrv_credits[target_cpu]--;
+	_ei(status);
+}
+
+/* number of packets of a message of the given size */
+static uint16_t ni_packets(uint16_t size)
+{
+	uint16_t payload_bytes;
+
+	payload_bytes = (NOC_PACKET_SIZE - PKT_HEADER_SIZE) * sizeof(uint16_t);
+	if (size == 0)
+		return 1;
+
+	return (size % payload_bytes == 0) ? (size / payload_bytes) : (size / payload_bytes + 1);
+}
+
+/* number of data bytes carried by a fragment (seq) of a message of the given size */
+static uint16_t ni_frag_bytes(uint16_t size, uint16_t seq)
+{
+	uint16_t offset;
+
+	offset = (seq - 1) * NOC_PAYLOAD_BYTES;
+	if (offset >= size)
+		return 0;
+
+	return size - offset < NOC_PAYLOAD_BYTES ? size - offset : NOC_PAYLOAD_BYTES;
+}
+
+/* reassembly table bucket of a (task, source cpu, source port, channel) tuple */
+static struct ni_reasm **ni_reasm_bucket(uint16_t id, uint16_t source_cpu, uint16_t source_port, uint16_t channel)
+{
+	uint32_t h;
+
+	h = id ^ (source_cpu << 5) ^ (source_port * 13) ^ (channel * 7);
+
+	return &pktdrv_reasm_hash[(h ^ (h >> 6)) & (NI_REASM_SLOTS - 1)];
+}
+
+/* returns a chain of fragments to the pool. called with interrupts disabled */
+static void ni_release(uint16_t id, uint16_t *buf_ptr)
+{
+	uint16_t *next;
+
+	while (buf_ptr){
+		next = PKT_LINK(buf_ptr);
+		ni_free(buf_ptr);
+		pktdrv_frags[id]--;
+		buf_ptr = next;
+	}
+}
+
+/* drops all pending fragments of a task. called with interrupts disabled */
+static void ni_reasm_flush(uint16_t id)
+{
+	struct ni_reasm **pr, *r;
+	int32_t i;
+
+	for (i = 0; i < NI_REASM_SLOTS; i++){
+		pr = &pktdrv_reasm_hash[i];
+		while ((r = *pr)){
+			if (r->id == id){
+				*pr = r->next;
+				ni_release(id, r->head);
+				r->next = pktdrv_reasm_free;
+				pktdrv_reasm_free = r;
+			}else{
+				pr = &r->next;
+			}
 		}
+	}
+}
 
-		if (buf_ptr[PKT_TARGET_CPU] != ((NOC_COLUMN(CPU_ID) << 4) | NOC_LINE(CPU_ID))){
-			kprintf("\nKERNEL: hardware error: this is not CPU X:%d Y:%d", (buf_ptr[PKT_TARGET_CPU] & 0xf0) >> 4, buf_ptr[PKT_TARGET_CPU] & 0xf);
-			hf_queue_addtail(pktdrv_queue, buf_ptr);
-			return;
+/* drops an entry of the reassembly table and its fragments. called with interrupts disabled */
+static void ni_reasm_evict(struct ni_reasm **pr)
+{
+	struct ni_reasm *r = *pr;
+
+	pktdrv_nstats[r->id].drops[NOC_DROP_STALE] += r->received;
+	*pr = r->next;
+	ni_release(r->id, r->head);
+	r->next = pktdrv_reasm_free;
+	pktdrv_reasm_free = r;
+}
+
+/* evicts the entries of a reassembly chain older than NOC_REASM_AGE ms. called with interrupts disabled */
+static int32_t ni_reasm_age(struct ni_reasm **pr, uint32_t now)
+{
+	struct ni_reasm *r;
+	int32_t evicted = 0;
+
+	while ((r = *pr)){
+		if (now - r->time > NI_REASM_AGE){
+			ni_reasm_evict(pr);
+			evicted++;
+		}else{
+			pr = &r->next;
 		}
+	}
 
-		switch (buf_ptr[PKT_TARGET_PORT]) {
-		case 0x0000:
-			hf_queue_addtail(pktdrv_queue, buf_ptr);
-			return;
-		case 0xffff:
-			if (pktdrv_callback)
-				pktdrv_callback(buf_ptr);
-			hf_queue_addtail(pktdrv_queue, buf_ptr);
-			return;
-		default:
+	return evicted;
+}
+
+/* evicts stale entries of the whole reassembly table, when it or the pool runs out. called with interrupts disabled */
+static int32_t ni_reasm_expire(void)
+{
+	uint32_t now;
+	int32_t i, evicted = 0;
+
+	now = _readcounter();
+	for (i = 0; i < NI_REASM_SLOTS; i++)
+		if (pktdrv_reasm_hash[i])
+			evicted += ni_reasm_age(&pktdrv_reasm_hash[i], now);
+
+	return evicted;
+}
+
+/* drops the fragments of a (task, source cpu, source port, channel) tuple pending reassembly. called with interrupts disabled */
+static void ni_reasm_drop(uint16_t id, uint16_t source_cpu, uint16_t source_port, uint16_t channel)
+{
+	struct ni_reasm **pr, *r;
+
+	pr = ni_reasm_bucket(id, source_cpu, source_port, channel);
+	for (; (r = *pr); pr = &r->next){
+		if (r->id == id && r->source_cpu == source_cpu && r->source_port == source_port && r->channel == channel){
+			*pr = r->next;
+			ni_release(id, r->head);
+			r->next = pktdrv_reasm_free;
+			pktdrv_reasm_free = r;
 			break;
 		}
+	}
+}
 
-		for (k = 0; k < MAX_TASKS; k++)
-			if (pktdrv_ports[k] == buf_ptr[PKT_TARGET_PORT]) break;
+/**
+ * @brief NoC driver: delivers a packet to a task.
+ *
+ * @param id is the task id which owns the communication queue
+ * @param buf_ptr is a packet taken from the pool
+ *
+ * @return ERR_OK when the packet was placed, ERR_SEQ_ERROR when the packet sequence is out of the message
+ * range or the fragment is duplicated and ERR_COMM_BUSY when the task has no room for the packet.
+ *
+ * Must be called with interrupts disabled (e.g. from ni_isr() or a packet driver callback). The packet is
+ * placed, by its sequence, in the reassembly entry of its (source cpu, source port, channel) tuple, so
+ * fragments from senders interleaved on the same port (or arriving out of order) do not have to be searched
+ * for on reception. Once all fragments of the message are present, the message is put on the task queue and
+ * the task is unblocked if it is waiting on the channel. Fragments of an incomplete message are evicted when
+ * they are older than NOC_REASM_AGE ms (checked on their hash chain, or on the whole table when the table, the
+ * pool or the task queue is full) or when the first fragment of a new message arrives on the same tuple. The
+ * packet is always consumed: on error, it is returned to the pool.
+ */
+int32_t ni_deliver(uint16_t id, uint16_t *buf_ptr)
+{
+	struct ni_reasm **bucket, **pr, *r;
+	struct noc_stats *st;
+	uint16_t *prev, *p, seq, packets;
 
-		if (k < MAX_TASKS && krnl_tcb[k].ptask){
-			if (hf_queue_addtail(pktdrv_tqueue[k], buf_ptr)){
-				kprintf("\nKERNEL: task (on port %d) queue full! dropping packet...", buf_ptr[PKT_TARGET_PORT]);
-				hf_queue_addtail(pktdrv_queue, buf_ptr);
+	packets = ni_packets(buf_ptr[PKT_MSG_SIZE]);
+	seq = buf_ptr[PKT_SEQ];
+	st = &pktdrv_nstats[id];
+	st->packets_in++;
+
+	if (seq == 0 || seq > packets){
+		st->drops[NOC_DROP_SEQ]++;
+		ni_free(buf_ptr);
+		return ERR_SEQ_ERROR;
+	}
+
+	if (buf_ptr[PKT_PAYLOAD] + 2 < NI_FLITS(ni_frag_bytes(buf_ptr[PKT_MSG_SIZE], seq))){
+		st->drops[NOC_DROP_HEADER]++;
+		ni_free(buf_ptr);
+		return ERR_SEQ_ERROR;
+	}
+
+	if (pktdrv_frags[id] >= pktdrv_tqueue[id]->size && (!ni_reasm_expire() || pktdrv_frags[id] >= pktdrv_tqueue[id]->size)){
+		st->drops[NOC_DROP_QUEUE]++;
+		ni_free(buf_ptr);
+		return ERR_COMM_BUSY;
+	}
+
+	PKT_LINK(buf_ptr) = NULL;
+	PKT_TIME(buf_ptr) = _readcounter();
+
+	if (packets > 1){
+		bucket = ni_reasm_bucket(id, buf_ptr[PKT_SOURCE_CPU], buf_ptr[PKT_SOURCE_PORT], buf_ptr[PKT_CHANNEL]);
+		if (*bucket)
+			ni_reasm_age(bucket, PKT_TIME(buf_ptr));
+		for (pr = bucket; (r = *pr); pr = &r->next)
+			if (r->id == id && r->source_cpu == buf_ptr[PKT_SOURCE_CPU] &&
+				r->source_port == buf_ptr[PKT_SOURCE_PORT] && r->channel == buf_ptr[PKT_CHANNEL]) break;
+
+		/* the first fragment of a new message: the pending one lost fragments and is never completed */
+		if (r && seq == 1 && (r->head[PKT_SEQ] == 1 || r->packets != packets)){
+			ni_reasm_evict(pr);
+			r = NULL;
+		}
+
+		if (r == NULL){
+			if (pktdrv_reasm_free == NULL)
+				ni_reasm_expire();
+			r = pktdrv_reasm_free;
+			if (r == NULL){
+				st->drops[NOC_DROP_REASM]++;
+				ni_free(buf_ptr);
+				return ERR_COMM_BUSY;
 			}
+			pktdrv_reasm_free = r->next;
+			r->next = *bucket;
+			r->head = NULL;
+			r->tail = NULL;
+			r->id = id;
+			r->source_cpu = buf_ptr[PKT_SOURCE_CPU];
+			r->source_port = buf_ptr[PKT_SOURCE_PORT];
+			r->channel = buf_ptr[PKT_CHANNEL];
+			r->packets = packets;
+			r->received = 0;
+			r->time = PKT_TIME(buf_ptr);
+			*bucket = r;
+			pr = bucket;
+		}
+
+		if (r->tail == NULL || r->tail[PKT_SEQ] < seq){
+			if (r->tail)
+				PKT_LINK(r->tail) = buf_ptr;
+			else
+				r->head = buf_ptr;
+			r->tail = buf_ptr;
 		}else{
-			kprintf("\nKERNEL: no task on port %d (offender: cpu %d port %d) - dropping packet...", buf_ptr[PKT_TARGET_PORT], buf_ptr[PKT_SOURCE_CPU], buf_ptr[PKT_SOURCE_PORT]);
-			hf_queue_addtail(pktdrv_queue, buf_ptr);
+			prev = NULL;
+			for (p = r->head; p[PKT_SEQ] < seq; p = PKT_LINK(p))
+				prev = p;
+			if (p[PKT_SEQ] == seq){
+				st->drops[NOC_DROP_SEQ]++;
+				ni_free(buf_ptr);
+				return ERR_SEQ_ERROR;
+			}
+			PKT_LINK(buf_ptr) = p;
+			if (prev)
+				PKT_LINK(prev) = buf_ptr;
+			else
+				r->head = buf_ptr;
 		}
+		pktdrv_frags[id]++;
+
+		if (pktdrv_frags[id] > st->held_hwm)
+			st->held_hwm = pktdrv_frags[id];
+
+		if (++r->received < r->packets)
+			return ERR_OK;
+
+		buf_ptr = r->head;
+		PKT_TIME(buf_ptr) = r->time;
+		*pr = r->next;
+		r->next = pktdrv_reasm_free;
+		pktdrv_reasm_free = r;
 	}else{
-		kprintf("\nKERNEL: NoC queue full! dropping packet...");
-		ni_flush(NOC_PACKET_SIZE);
+		pktdrv_frags[id]++;
+	}
+
+	if (pktdrv_frags[id] > st->held_hwm)
+		st->held_hwm = pktdrv_frags[id];
+
+	if (hf_queue_addtail(pktdrv_tqueue[id], buf_ptr)){
+		st->drops[NOC_DROP_QUEUE] += ni_packets(buf_ptr[PKT_MSG_SIZE]);
+		ni_release(id, buf_ptr);
+		return ERR_COMM_BUSY;
+	}
+	st->messages_in++;
+	if (hf_queue_count(pktdrv_tqueue[id]) > st->queue_hwm)
+		st->queue_hwm = hf_queue_count(pktdrv_tqueue[id]);
+	ni_wakeup(id, buf_ptr[PKT_CHANNEL]);
+
+	return ERR_OK;
+}
+
+/* accounts the latency of a message taken by a task. called with interrupts disabled */
+static void ni_latency(uint16_t id, uint16_t *buf_ptr)
+{
+	uint32_t lat;
+	int32_t k = 0;
+
+	lat = (_readcounter() - PKT_TIME(buf_ptr)) >> NOC_LAT_SHIFT;
+	while (lat && k < NOC_LAT_BUCKETS - 1){
+		lat >>= 1;
+		k++;
+	}
+	pktdrv_nstats[id].latency[k]++;
+}
+
+/* number of ticks of a period (ms) of a driver task. the length of a tick is measured between two consecutive wakeups */
+static uint32_t ni_ticks(uint32_t period)
+{
+	uint32_t time, ticks;
+
+	hf_delay(hf_selfid(), 1);
+	time = _read_us();
+	hf_delay(hf_selfid(), 1);
+	time = _read_us() - time;
+	ticks = time ? period * 1000 / time : 1;
+	if (ticks == 0)
+		ticks = 1;
+
+	return ticks;
+}
+
+/* dumps the statistics every NOC_STATS_PERIOD ms */
+static void ni_stats_task(void)
+{
+	uint32_t ticks;
+
+	ticks = ni_ticks(NOC_STATS_PERIOD);
+	for (;;){
+		hf_delay(hf_selfid(), ticks);
+		hf_nocstats_dump();
+	}
+}
+
+/*
+ * takes the first complete message of a channel from the task queue, keeping the order of other messages.
+ * the task blocks until a message of the channel is complete.
+ */
+static uint16_t *ni_take_message(uint16_t id, uint16_t channel)
+{
+	struct queue *q = pktdrv_tqueue[id];
+	uint32_t status;
+	int32_t i, j, k;
+	uint16_t *buf_ptr;
+
+	status = _di();
+	while (1){
+		k = hf_queue_count(q);
+		for (i = 0; i < k; i++){
+			buf_ptr = hf_queue_get(q, i);
+			if (buf_ptr[PKT_CHANNEL] == channel) break;
+		}
+		if (i < k){
+			for (j = i; j > 0; j--)
+				hf_queue_swap(q, j, j - 1);
+			break;
+		}
+		_ei(status);
+		ni_credit_flush(1);
+		status = _di();
+		if (hf_queue_count(q) != k)
+			continue;
+		ni_block(id, channel, &status);
 	}
+	buf_ptr = hf_queue_remhead(q);
+	ni_latency(id, buf_ptr);
+	_ei(status);
 
-	return;
+	return buf_ptr;
 }
 
 /**
@@ -179,7 +884,8 @@ uint16_t hf_ncores(void)
  * using the specified port and ERR_OUT_OF_MEMORY if the systems runs out of memory.
  *
  * The queue created for the task will be used for the reception of data. Both ni_isr() and hf_recv()
- * routines will manage the queue, putting and pulling packets from the queue on demand. The communication
+ * routines will manage the queue, putting and pulling messages from the queue on demand. Packets held
+ * by the task (on complete messages or pending reassembly) are limited to the size of the queue. The communication
  * subsystem is configured by the association of a task id to a receiving port (alias) and the definition
  * of how many packet slots a task has on its queue.
  *
@@ -211,6 +917,11 @@ int32_t hf_comm_create(uint16_t id, uint16_t port, uint16_t packets)
 		return ERR_OUT_OF_MEMORY;
 	}else{
 		pktdrv_ports[id] = port;
+		pktdrv_wait[id] = NI_WAIT_NONE;
+		pktdrv_frags[id] = 0;
+		memset(&pktdrv_nstats[id], 0, sizeof(struct noc_stats));
+		if (NOC_STATS_PERIOD && pktdrv_stats_task == 0)
+			pktdrv_stats_task = hf_spawn(ni_stats_task, 0, 0, 0, "NoC stats", 1024);
 
 		return ERR_OK;
 	}
@@ -227,7 +938,8 @@ int32_t hf_comm_create(uint16_t id, uint16_t port, uint16_t packets)
  */
 int32_t hf_comm_destroy(uint16_t id)
 {
-	int32_t status;
+	struct ni_window *window;
+	int32_t status, k;
 
 	if (id < MAX_TASKS){
 		if (krnl_tcb[id].ptask == 0)
@@ -238,9 +950,36 @@ int32_t hf_comm_destroy(uint16_t id)
 
 	status = _di();
 	while (hf_queue_count(pktdrv_tqueue[id]))
-		hf_queue_addtail(pktdrv_queue, hf_queue_remhead(pktdrv_tqueue[id]));
+		ni_release(id, hf_queue_remhead(pktdrv_tqueue[id]));
+	ni_reasm_flush(id);
+	for (k = 0; k < NOC_STREAMS; k++){
+		if (pktdrv_tx[k].id == id)
+			pktdrv_tx[k].port = 0;
+		if (pktdrv_rx[k].id == id)
+			pktdrv_rx[k].port = 0;
+	}
 	_ei(status);
 
+	/* the window is taken from the transport task once it is not sending a message of it */
+	while (pktdrv_window[id]){
+		status = _di();
+		for (k = 0; k < NOC_WINDOW; k++)
+			if (pktdrv_window[id][k].busy) break;
+		window = pktdrv_window[id];
+		if (k == NOC_WINDOW)
+			pktdrv_window[id] = NULL;
+		pktdrv_ackerr[id] = ERR_OK;
+		_ei(status);
+		if (k < NOC_WINDOW){
+			hf_yield();
+			continue;
+		}
+		for (k = 0; k < NOC_WINDOW; k++)
+			if (window[k].buf)
+				hf_free(window[k].buf);
+		hf_free(window);
+	}
+
 	if (hf_queue_destroy(pktdrv_tqueue[id])){
 		return ERR_COMM_ERROR;
 	}else{
@@ -284,101 +1023,88 @@ int32_t hf_recvprobe(void)
 }
 
 /**
- * @brief Receives a message from a task (blocking receive).
+ * @brief Waits for a message from a task (blocking probe).
+
+ * @return channel of the first message that is waiting in queue (a value >= 0), ERR_COMM_EMPTY when the
+ * first message in queue is a flow control message, ERR_COMM_UNFEASIBLE when no message queue (comm) was created.
  *
- * @param source_cpu is a pointer to a variable which will hold the source cpu
- * @param source_port is a pointer to a variable which will hold the source port
- * @param buf is a pointer to a buffer to hold the received message
- * @param size a pointer to a variable which will hold the size (in bytes) of the received message
+ * Same as hf_recvprobe(), but if there are no messages in queue the task is blocked until ni_isr() puts a
+ * complete message on its queue, instead of polling.
+ */
+int32_t hf_recvwait(void)
+{
+	uint16_t id;
+	uint32_t status;
+
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
+
+	status = _di();
+	while (hf_queue_count(pktdrv_tqueue[id]) == 0){
+		_ei(status);
+		ni_credit_flush(1);
+		status = _di();
+		if (hf_queue_count(pktdrv_tqueue[id]))
+			break;
+		ni_block(id, NI_WAIT_ANY, &status);
+	}
+	_ei(status);
+
+	return hf_recvprobe();
+}
+
+/**
+ * @brief Receives a message from a task (blocking receive).
+ *
+ * @param source_cpu is a pointer to a variable which will hold the source cpu
+ * @param source_port is a pointer to a variable which will hold the source port
+ * @param buf is a pointer to a buffer to hold the received message
+ * @param size a pointer to a variable which will hold the size (in bytes) of the received message
  * @param channel is the selected message channel of this message (must be the same as in the sender)
  *
  * @return ERR_OK when successful, ERR_COMM_UNFEASIBLE when no message queue (comm) was
- * created and ERR_SEQ_ERROR when received packets arrive out of order, so the message
+ * created and ERR_SEQ_ERROR when received packets are not in sequence, so the message
  * is corrupted.
  *
- * A message is build from packets received on the ni_isr() routine. Packets are decoded and
- * combined in a complete message, returning the message, its size and source identification
- * to the calling task. The buffer where the message will be stored must be large enough or
- * we will have a problem that may not be noticed before its too late.
+ * A message is build from packets received on the ni_isr() routine. Packets are reassembled
+ * by ni_deliver() in sequence order, and the complete message is decoded, returning the message,
+ * its size and source identification to the calling task. The buffer where the message will be
+ * stored must be large enough or we will have a problem that may not be noticed before its too
+ * late. While no complete message of the channel is on the task queue, the task is blocked and
+ * ni_isr() unblocks it when the last fragment arrives, so waiting tasks do not consume processor time.
  */
 int32_t hf_recv(uint16_t *source_cpu, uint16_t *source_port, int8_t *buf, uint16_t *size, uint16_t channel)
 {
-	uint16_t id, seq = 0, packet = 0, packets, payload_bytes;
+	uint16_t id, seq = 0;
 	uint32_t status;
-	int32_t i, k, p = 0, error = ERR_OK;
-	uint16_t *buf_ptr;
+	int32_t i, p = 0, error = ERR_OK;
+	uint16_t *buf_ptr, *next;
 
 	id = hf_selfid();
 	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
 
-	while (1){
-		k = hf_queue_count(pktdrv_tqueue[id]);
-		if (k){
-			buf_ptr = hf_queue_get(pktdrv_tqueue[id], 0);
-			if (buf_ptr)
-				if (buf_ptr[PKT_CHANNEL] == channel && buf_ptr[PKT_SEQ] == seq + 1) break;
-
-			status = _di();
-			buf_ptr = hf_queue_remhead(pktdrv_tqueue[id]);
-			hf_queue_addtail(pktdrv_tqueue[id], buf_ptr);
-			_ei(status);
-		}
-	}
-
-	status = _di();
-	buf_ptr = hf_queue_remhead(pktdrv_tqueue[id]);
-	_ei(status);
+	buf_ptr = ni_take_message(id, channel);
 
 	*source_cpu = buf_ptr[PKT_SOURCE_CPU];
 	*source_port = buf_ptr[PKT_SOURCE_PORT];
 	*size = buf_ptr[PKT_MSG_SIZE];
-	seq = buf_ptr[PKT_SEQ];
-
-	payload_bytes = (NOC_PACKET_SIZE - PKT_HEADER_SIZE) * sizeof(uint16_t);
-	packets = (*size % payload_bytes == 0) ? (*size / payload_bytes) : (*size / payload_bytes + 1);
 
-	while (++packet < packets){
-		if (buf_ptr[PKT_SEQ] != seq++)
+	while (buf_ptr){
+		if (buf_ptr[PKT_SEQ] != ++seq)
 			error = ERR_SEQ_ERROR;
 
-		for (i = PKT_HEADER_SIZE; i < NOC_PACKET_SIZE; i++){
+		for (i = PKT_HEADER_SIZE; i < NOC_PACKET_SIZE && p < *size; i++){
 			buf[p++] = (uint8_t)(buf_ptr[i] >> 8);
 			buf[p++] = (uint8_t)(buf_ptr[i] & 0xff);
 		}
+		next = PKT_LINK(buf_ptr);
 		status = _di();
-		hf_queue_addtail(pktdrv_queue, buf_ptr);
-		_ei(status);
-
-		i = 0;
-		while (1){
-			k = hf_queue_count(pktdrv_tqueue[id]);
-			if (k){
-				buf_ptr = hf_queue_get(pktdrv_tqueue[id], 0);
-				if (buf_ptr)
-					if (buf_ptr[PKT_CHANNEL] == channel && buf_ptr[PKT_SEQ] == seq) break;
-
-				status = _di();
-				buf_ptr = hf_queue_remhead(pktdrv_tqueue[id]);
-				hf_queue_addtail(pktdrv_tqueue[id], buf_ptr);
-				_ei(status);
-				if (i++ > NOC_PACKET_SLOTS << 3) break;
-			}
-		}
-		status = _di();
-		buf_ptr = hf_queue_remhead(pktdrv_tqueue[id]);
+		ni_free(buf_ptr);
+		pktdrv_frags[id]--;
 		_ei(status);
+		buf_ptr = next;
 	}
-
-	if (buf_ptr[PKT_SEQ] != seq++)
-		error = ERR_SEQ_ERROR;
-
-	for (i = PKT_HEADER_SIZE; i < NOC_PACKET_SIZE && p < *size; i++){
-		buf[p++] = (uint8_t)(buf_ptr[i] >> 8);
-		buf[p++] = (uint8_t)(buf_ptr[i] & 0xff);
-	}
-	status = _di();
-	hf_queue_addtail(pktdrv_queue, buf_ptr);
-	_ei(status);
+	ni_credit_flush(NOC_CREDIT_BATCH);
 
 	return error;
 }
@@ -392,134 +1118,1272 @@ int32_t hf_recv(uint16_t *source_cpu, uint16_t *source_port, int8_t *buf, uint16
  * @param size is the size (in bytes) of the message
  * @param channel is the selected message channel of this message (must be the same as in the receiver)
  *
- * @return ERR_OK
+ * @return ERR_OK when successful, ERR_COMM_UNFEASIBLE when no message queue (comm) was created and
+ * ERR_INVALID_CPU when the target processor does not exist.
  *
  * A message is broken into packets containing a header and part of the message as the payload.
- * The packets are injected, one by one, in the network through the network interface.
+ * The packets are injected, one by one, in the network through the network interface. Each packet
+ * takes a credit of the target processor, and the task is blocked while there are no credits left.
+ * Credits are given back by the target processor as its tasks consume packets, so the shared pool
+ * of packets of the target is not overrun.
  */
 int32_t hf_send(uint16_t target_cpu, uint16_t target_port, int8_t *buf, uint16_t size, uint16_t channel)
 {
-	uint16_t packet = 0, packets, payload_bytes, id;
-	int32_t i, p = 0;
-	uint16_t out_buf[NOC_PACKET_SIZE];
+	struct noc_iovec iov;
 
-	id = hf_selfid();
-	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
+	iov.base = buf;
+	iov.len = size;
 
-	payload_bytes = (NOC_PACKET_SIZE - PKT_HEADER_SIZE) * sizeof(uint16_t);
-	packets = (size % payload_bytes == 0) ? (size / payload_bytes) : (size / payload_bytes + 1);
+	return hf_sendv(target_cpu, target_port, &iov, 1, channel);
+}
 
-	while (++packet < packets){
-		out_buf[PKT_TARGET_CPU] = (NOC_COLUMN(target_cpu) << 4) | NOC_LINE(target_cpu);
-		out_buf[PKT_PAYLOAD] = NOC_PACKET_SIZE - 2;
-		out_buf[PKT_SOURCE_CPU] = hf_cpuid();
-		out_buf[PKT_SOURCE_PORT] = pktdrv_ports[id];
-		out_buf[PKT_TARGET_PORT] = target_port;
-		out_buf[PKT_MSG_SIZE] = size;
-		out_buf[PKT_SEQ] = packet;
-		out_buf[PKT_CHANNEL] = channel;
+/* packs the next bytes of a message, taken from a list of fragments, on the payload of a packet.
+ * the cursor (current fragment and offset) is advanced and the number of bytes packed is returned */
+static uint16_t ni_gather(uint16_t *buf_ptr, struct noc_iovec **iov, struct noc_iovec *end, uint16_t *off)
+{
+	uint16_t *data = buf_ptr + PKT_HEADER_SIZE;
+	uint8_t *p;
+	int32_t j = 0, k, n;
 
-		for (i = PKT_HEADER_SIZE; i < NOC_PACKET_SIZE; i++, p+=2)
-			out_buf[i] = ((uint8_t)buf[p] << 8) | (uint8_t)buf[p+1];
+	while (j < NOC_PAYLOAD_BYTES && *iov < end){
+		p = (uint8_t *)(*iov)->base + *off;
+		n = (*iov)->len - *off;
+		if (n > NOC_PAYLOAD_BYTES - j)
+			n = NOC_PAYLOAD_BYTES - j;
 
-		ni_write_packet(out_buf, NOC_PACKET_SIZE);
+		k = 0;
+		if ((j & 1) && n > 0){
+			data[j >> 1] |= p[k++];
+			j++;
+		}
+		for (; k + 1 < n; k += 2, j += 2)
+			data[j >> 1] = (p[k] << 8) | p[k + 1];
+		if (k < n){
+			data[j >> 1] = p[k++] << 8;
+			j++;
+		}
+
+		*off += n;
+		if (*off == (*iov)->len){
+			(*iov)++;
+			*off = 0;
+		}
+	}
+
+	return j;
+}
+
+/* unpacks the payload of a packet (bytes long) to a list of fragments, advancing the cursor.
+ * bytes that do not fit on the fragments are discarded */
+static void ni_scatter(uint16_t *buf_ptr, uint16_t bytes, struct noc_iovec **iov, struct noc_iovec *end, uint16_t *off)
+{
+	uint16_t *data = buf_ptr + PKT_HEADER_SIZE;
+	uint8_t *p;
+	int32_t j = 0, k, n;
+
+	while (j < bytes && *iov < end){
+		p = (uint8_t *)(*iov)->base + *off;
+		n = (*iov)->len - *off;
+		if (n > bytes - j)
+			n = bytes - j;
+
+		k = 0;
+		if ((j & 1) && n > 0){
+			p[k++] = data[j >> 1] & 0xff;
+			j++;
+		}
+		for (; k + 1 < n; k += 2, j += 2){
+			p[k] = data[j >> 1] >> 8;
+			p[k + 1] = data[j >> 1] & 0xff;
+		}
+		if (k < n){
+			p[k++] = data[j >> 1] >> 8;
+			j++;
+		}
+
+		*off += n;
+		if (*off == (*iov)->len){
+			(*iov)++;
+			*off = 0;
+		}
 	}
+}
+
+/**
+ * @brief Sends a message gathered from a list of fragments (blocking scatter-gather send).
+ *
+ * @param target_cpu is the target processor
+ * @param target_port is the target task port
+ * @param iov is an array of fragments (address and size) that form the message, in order
+ * @param iovcnt is the number of fragments
+ * @param channel is the selected message channel of this message (must be the same as in the receiver)
+ *
+ * @return ERR_OK when successful, ERR_COMM_UNFEASIBLE when no message queue (comm) was created,
+ * ERR_INVALID_CPU when the target processor does not exist and ERR_COMM_ERROR when the message
+ * is too large.
+ *
+ * Same as hf_send(), but the payload of each packet is packed directly from the fragments, so a
+ * message made of separate parts (such as a header, data and a trailing checksum) does not have to
+ * be staged on a contiguous buffer first. The packet header is built once and only the sequence
+ * number changes between packets. The message is received as a whole, with hf_recv(), hf_recvv()
+ * or hf_recvpkt().
+ */
+int32_t hf_sendv(uint16_t target_cpu, uint16_t target_port, struct noc_iovec *iov, uint16_t iovcnt, uint16_t channel)
+{
+	return ni_sendv(hf_selfid(), target_cpu, target_port, iov, iovcnt, channel);
+}
+
+/* sends a message from the port of task id. called by the task, or by the transport task on its behalf */
+static int32_t ni_sendv(uint16_t id, uint16_t target_cpu, uint16_t target_port, struct noc_iovec *iov, uint16_t iovcnt, uint16_t channel)
+{
+	uint16_t packet, packets, off = 0, bytes;
+	uint32_t size = 0;
+	int32_t i;
+	struct noc_iovec *end = iov + iovcnt;
+	uint16_t out_buf[NOC_PACKET_SIZE];
+
+	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
+	if (target_cpu >= NOC_WIDTH * NOC_HEIGHT) return ERR_INVALID_CPU;
+
+	for (i = 0; i < iovcnt; i++)
+		size += iov[i].len;
+	if (size > 0xffff) return ERR_COMM_ERROR;
 
 	out_buf[PKT_TARGET_CPU] = (NOC_COLUMN(target_cpu) << 4) | NOC_LINE(target_cpu);
-	out_buf[PKT_PAYLOAD] = NOC_PACKET_SIZE - 2;
 	out_buf[PKT_SOURCE_CPU] = hf_cpuid();
 	out_buf[PKT_SOURCE_PORT] = pktdrv_ports[id];
 	out_buf[PKT_TARGET_PORT] = target_port;
 	out_buf[PKT_MSG_SIZE] = size;
-	out_buf[PKT_SEQ] = packet;
 	out_buf[PKT_CHANNEL] = channel;
 
-	for (i = PKT_HEADER_SIZE; i < NOC_PACKET_SIZE && (p < size); i++, p+=2)
-		out_buf[i] = ((uint8_t)buf[p] << 8) | (uint8_t)buf[p+1];
-	for(; i < NOC_PACKET_SIZE; i++)
-		out_buf[i] = 0xdead;
+	packets = ni_packets(size);
+
+	for (packet = 1; packet <= packets; packet++){
+		out_buf[PKT_SEQ] = packet;
+
+		bytes = ni_gather(out_buf, &iov, end, &off);
+		out_buf[PKT_PAYLOAD] = NI_FLITS(bytes) - 2;
 
-	ni_write_packet(out_buf, NOC_PACKET_SIZE);
-	delay_ms(1);
+		ni_credit_take(id, target_cpu);
+		ni_write_packet(out_buf, NI_FLITS(bytes));
+		pktdrv_nstats[id].packets_out++;
+	}
 
 	return ERR_OK;
 }
 
 /**
- * @brief Receives a message from a task (blocking receive) with acknowledgement.
+ * @brief Receives a message scattered to a list of fragments (blocking scatter-gather receive).
  *
  * @param source_cpu is a pointer to a variable which will hold the source cpu
  * @param source_port is a pointer to a variable which will hold the source port
- * @param buf is a pointer to a buffer to hold the received message
+ * @param iov is an array of fragments (address and size) to be filled with the message, in order
+ * @param iovcnt is the number of fragments
  * @param size a pointer to a variable which will hold the size (in bytes) of the received message
  * @param channel is the selected message channel of this message (must be the same as in the sender)
  *
  * @return ERR_OK when successful, ERR_COMM_UNFEASIBLE when no message queue (comm) was
- * created and ERR_SEQ_ERROR when received packets arrive out of order, so the message
- * is corrupted.
+ * created, ERR_SEQ_ERROR when received packets are not in sequence, so the message
+ * is corrupted and ERR_COMM_ERROR when the message does not fit on the fragments.
  *
- * A message is build from packets received on the ni_isr() routine. Packets are decoded and
- * combined in a complete message, returning the message, its size and source identification
- * to the calling task. The buffer where the message will be stored must be large enough or
- * we will have a problem that may not be noticed before its too late. After the reception
- * of the whole message is completed, an acknowledgement is sent to the sender task. This works
- * as a flow control mechanism, avoiding buffer/queue overflows common to the raw protocol.
- * Message channel 65535 will be used for the flow control mechanism. This routine must be used
- * exclusively with hf_sendack().
+ * Same as hf_recv(), but the payload of each packet is unpacked directly to the fragments, so the
+ * parts of a message (such as data and a trailing checksum) land where they are used. When the
+ * message is larger than the fragments, the bytes that do not fit are discarded.
  */
-int32_t hf_recvack(uint16_t *source_cpu, uint16_t *source_port, int8_t *buf, uint16_t *size, uint16_t channel)
+int32_t hf_recvv(uint16_t *source_cpu, uint16_t *source_port, struct noc_iovec *iov, uint16_t iovcnt, uint16_t *size, uint16_t channel)
 {
-	int32_t error;
+	uint16_t id, seq = 0, off = 0, bytes;
+	uint32_t status, room = 0;
+	int32_t i, p = 0, error = ERR_OK;
+	struct noc_iovec *end = iov + iovcnt;
+	uint16_t *buf_ptr, *next;
+
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
+
+	for (i = 0; i < iovcnt; i++)
+		room += iov[i].len;
+
+	buf_ptr = ni_take_message(id, channel);
 
-	error = hf_recv(source_cpu, source_port, buf, size, channel);
-	if (error == ERR_OK){
-		hf_send(*source_cpu, *source_port, "ok", 3, 65535);
+	*source_cpu = buf_ptr[PKT_SOURCE_CPU];
+	*source_port = buf_ptr[PKT_SOURCE_PORT];
+	*size = buf_ptr[PKT_MSG_SIZE];
+	if (*size > room)
+		error = ERR_COMM_ERROR;
+
+	while (buf_ptr){
+		if (buf_ptr[PKT_SEQ] != ++seq)
+			error = ERR_SEQ_ERROR;
+
+		bytes = *size - p < NOC_PAYLOAD_BYTES ? *size - p : NOC_PAYLOAD_BYTES;
+		ni_scatter(buf_ptr, bytes, &iov, end, &off);
+		p += bytes;
+
+		next = PKT_LINK(buf_ptr);
+		status = _di();
+		ni_free(buf_ptr);
+		pktdrv_frags[id]--;
+		_ei(status);
+		buf_ptr = next;
 	}
+	ni_credit_flush(NOC_CREDIT_BATCH);
 
 	return error;
 }
 
 /**
- * @brief Sends a message to a task (blocking send) with acknowledgement.
+ * @brief Sends a message to the tasks on a port of a rectangle of processors (blocking multicast).
+ *
+ * @param first_cpu is a processor on a corner of the rectangle
+ * @param last_cpu is the processor on the opposite corner of the rectangle
+ * @param target_port is the target task port (the same on all processors)
+ * @param buf is a pointer to a buffer that holds the message
+ * @param size is the size (in bytes) of the message
+ * @param channel is the selected message channel of this message (must be the same as in the receivers)
+ *
+ * @return ERR_OK when successful, ERR_COMM_UNFEASIBLE when no message queue (comm) was created and
+ * ERR_INVALID_CPU when a processor does not exist.
+ *
+ * Each packet is injected only once. The header carries the rectangle (the unicast header of the first
+ * corner plus the extent on its upper byte) and the routers replicate the flits at the branches of the
+ * XY tree which covers the rectangle, so the injection bandwidth used by the sender does not depend on the
+ * number of receivers. The message is not delivered to the sender, even if it is inside the rectangle.
+ * A credit of every receiver is taken for each packet. Messages are received with hf_recv().
+ */
+int32_t hf_multicast(uint16_t first_cpu, uint16_t last_cpu, uint16_t target_port, int8_t *buf, uint16_t size, uint16_t channel)
+{
+	uint16_t packet = 0, packets, id, x0, y0, x1, y1, x, y, bytes;
+	int32_t i, p = 0;
+	uint16_t out_buf[NOC_PACKET_SIZE];
+
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
+	if (first_cpu >= NOC_WIDTH * NOC_HEIGHT || last_cpu >= NOC_WIDTH * NOC_HEIGHT) return ERR_INVALID_CPU;
+
+	x0 = NOC_COLUMN(first_cpu) < NOC_COLUMN(last_cpu) ? NOC_COLUMN(first_cpu) : NOC_COLUMN(last_cpu);
+	x1 = NOC_COLUMN(first_cpu) < NOC_COLUMN(last_cpu) ? NOC_COLUMN(last_cpu) : NOC_COLUMN(first_cpu);
+	y0 = NOC_LINE(first_cpu) < NOC_LINE(last_cpu) ? NOC_LINE(first_cpu) : NOC_LINE(last_cpu);
+	y1 = NOC_LINE(first_cpu) < NOC_LINE(last_cpu) ? NOC_LINE(last_cpu) : NOC_LINE(first_cpu);
+
+	if (x0 == x1 && y0 == y1)
+		return hf_send(first_cpu, target_port, buf, size, channel);
+
+	packets = ni_packets(size);
+
+	while (++packet <= packets){
+		bytes = ni_frag_bytes(size, packet);
+		out_buf[PKT_TARGET_CPU] = ((x1 - x0) << 12) | ((y1 - y0) << 8) | (x0 << 4) | y0;
+		out_buf[PKT_PAYLOAD] = NI_FLITS(bytes) - 2;
+		out_buf[PKT_SOURCE_CPU] = hf_cpuid();
+		out_buf[PKT_SOURCE_PORT] = pktdrv_ports[id];
+		out_buf[PKT_TARGET_PORT] = target_port;
+		out_buf[PKT_MSG_SIZE] = size;
+		out_buf[PKT_SEQ] = packet;
+		out_buf[PKT_CHANNEL] = channel;
+
+		for (i = PKT_HEADER_SIZE; i < NI_FLITS(bytes); i++, p+=2)
+			out_buf[i] = ((uint8_t)buf[p] << 8) | (uint8_t)buf[p+1];
+
+		for (y = y0; y <= y1; y++)
+			for (x = x0; x <= x1; x++)
+				if (y * NOC_WIDTH + x != hf_cpuid())
+					ni_credit_take(id, y * NOC_WIDTH + x);
+		ni_write_packet(out_buf, NI_FLITS(bytes));
+		pktdrv_nstats[id].packets_out++;
+	}
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Sends a message to the tasks on a port of all other processors (blocking broadcast).
+ *
+ * @param target_port is the target task port (the same on all processors)
+ * @param buf is a pointer to a buffer that holds the message
+ * @param size is the size (in bytes) of the message
+ * @param channel is the selected message channel of this message (must be the same as in the receivers)
+ *
+ * @return ERR_OK when successful and ERR_COMM_UNFEASIBLE when no message queue (comm) was created.
+ *
+ * Same as hf_multicast(), with the whole mesh as the rectangle.
+ */
+int32_t hf_broadcast(uint16_t target_port, int8_t *buf, uint16_t size, uint16_t channel)
+{
+	if (NOC_WIDTH * NOC_HEIGHT == 1)
+		return ERR_OK;
+
+	return hf_multicast(0, NOC_WIDTH * NOC_HEIGHT - 1, target_port, buf, size, channel);
+}
+
+/**
+ * @brief Lends packets from the shared pool to the calling task (zero-copy API).
+ *
+ * @param size is the size (in bytes) of the message that will be built on the packets
+ *
+ * @return a pointer to the first packet of the message or NULL if there are not enough free packets
+ * on the pool or more than NOC_LENT_SLOTS packets would be lent.
+ *
+ * Enough packets for a message of the given size are taken from the pool and linked. The message
+ * is written in place, using PKT_DATA() to access the payload of each packet (NOC_PAYLOAD_BYTES bytes
+ * in network (big endian) order) and hf_pktnext() to walk the packets. Packets are returned to the
+ * pool by hf_sendpkt() or hf_pktfree(). Packets lent for sending are not available for reception,
+ * so they should be held only for a short time.
+ */
+uint16_t *hf_pktalloc(uint16_t size)
+{
+	uint32_t status;
+	int32_t i, packets;
+	uint16_t *pkt = NULL, *buf_ptr;
+
+	packets = ni_packets(size);
+
+	status = _di();
+	if (pktdrv_lent + packets <= NOC_LENT_SLOTS && hf_queue_count(pktdrv_queue) >= packets){
+		pktdrv_lent += packets;
+		for (i = 0; i < packets; i++){
+			buf_ptr = hf_queue_remtail(pktdrv_queue);
+			buf_ptr[PKT_SOURCE_CPU] = 0xffff;
+			PKT_LINK(buf_ptr) = pkt;
+			pkt = buf_ptr;
+		}
+	}
+	_ei(status);
+
+	return pkt;
+}
+
+/**
+ * @brief Returns packets (lent by hf_pktalloc() or hf_recvpkt()) to the shared pool.
+ *
+ * @param pkt is a pointer to the first packet of a message
+ */
+void hf_pktfree(uint16_t *pkt)
+{
+	uint32_t status;
+	uint16_t *next;
+
+	status = _di();
+	while (pkt){
+		next = PKT_LINK(pkt);
+		if (pkt[PKT_SOURCE_CPU] == 0xffff)
+			pktdrv_lent--;
+		ni_free(pkt);
+		pkt = next;
+	}
+	_ei(status);
+	ni_credit_flush(NOC_CREDIT_BATCH);
+}
+
+/**
+ * @brief Returns the next packet of a message.
+ *
+ * @param pkt is a pointer to a packet of a message
+ *
+ * @return a pointer to the next packet of the message or NULL if this is the last one.
+ */
+uint16_t *hf_pktnext(uint16_t *pkt)
+{
+	return PKT_LINK(pkt);
+}
+
+/**
+ * @brief Sends a message built in place on lent packets (blocking send).
  *
  * @param target_cpu is the target processor
  * @param target_port is the target task port
- * @param buf is a pointer to a buffer that holds the message
+ * @param pkt is a pointer to the first packet of the message, returned by hf_pktalloc()
  * @param size is the size (in bytes) of the message
  * @param channel is the selected message channel of this message (must be the same as in the receiver)
- * @param timeout is the time (in ms) that the sender will wait for a reception acknowledgement
  *
- * @return ERR_OK
+ * @return ERR_OK when successful, ERR_COMM_UNFEASIBLE when no message queue (comm) was created,
+ * ERR_INVALID_CPU when the target processor does not exist and ERR_COMM_ERROR when the message
+ * does not fit on the packets.
  *
- * A message is broken into packets containing a header and part of the message as the payload.
- * The packets are injected, one by one, in the network through the network interface. After that, the
- * sender will wait for an acknowledgement from the receiver. This works as a flow control mechanism,
- * avoiding buffer/queue overflows common to the raw protocol. Message channel 65535 will be used for
- * the flow control mechanism. This routine should be used exclusively with hf_recvack().
+ * Only the header of each packet is filled, and the packets are injected in the network as they are
+ * (taking credits as hf_send() does).
+ * The packets are returned to the pool after the message is sent (also on error). The message can be
+ * received with hf_recv() or hf_recvpkt().
  */
-int32_t hf_sendack(uint16_t target_cpu, uint16_t target_port, int8_t *buf, uint16_t size, uint16_t channel, uint32_t timeout)
+int32_t hf_sendpkt(uint16_t target_cpu, uint16_t target_port, uint16_t *pkt, uint16_t size, uint16_t channel)
 {
-	uint16_t id, source_cpu, source_port;
-	int32_t error, k;
-	uint32_t time;
-	int8_t ack[4];
+	uint16_t packet = 0, id, source;
 	uint16_t *buf_ptr;
 
-	error = hf_send(target_cpu, target_port, buf, size, channel);
-	if (error == ERR_OK){
-		id = hf_selfid();
-		time = _read_us() / 1000;
-		while (1){
-			k = hf_queue_count(pktdrv_tqueue[id]);
-			if (k){
-				buf_ptr = hf_queue_get(pktdrv_tqueue[id], 0);
-				if (buf_ptr)
-					if (buf_ptr[PKT_CHANNEL] == 65535 && buf_ptr[PKT_MSG_SIZE] == 3) break;
-			}
-			if (((_read_us() / 1000) - time) > timeout) return ERR_COMM_TIMEOUT;
-		}
-		hf_recv(&source_cpu, &source_port, ack, &size, 65535);
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL){
+		hf_pktfree(pkt);
+		return ERR_COMM_UNFEASIBLE;
+	}
+	if (target_cpu >= NOC_WIDTH * NOC_HEIGHT){
+		hf_pktfree(pkt);
+		return ERR_INVALID_CPU;
+	}
+
+	for (buf_ptr = pkt; buf_ptr; buf_ptr = PKT_LINK(buf_ptr))
+		packet++;
+	if (packet < ni_packets(size)){
+		hf_pktfree(pkt);
+		return ERR_COMM_ERROR;
+	}
+
+	for (packet = 1, buf_ptr = pkt; packet <= ni_packets(size); packet++, buf_ptr = PKT_LINK(buf_ptr)){
+		source = buf_ptr[PKT_SOURCE_CPU];
+		buf_ptr[PKT_TARGET_CPU] = (NOC_COLUMN(target_cpu) << 4) | NOC_LINE(target_cpu);
+		buf_ptr[PKT_PAYLOAD] = NI_FLITS(ni_frag_bytes(size, packet)) - 2;
+		buf_ptr[PKT_SOURCE_CPU] = hf_cpuid();
+		buf_ptr[PKT_SOURCE_PORT] = pktdrv_ports[id];
+		buf_ptr[PKT_TARGET_PORT] = target_port;
+		buf_ptr[PKT_MSG_SIZE] = size;
+		buf_ptr[PKT_SEQ] = packet;
+		buf_ptr[PKT_CHANNEL] = channel;
+
+		ni_credit_take(id, target_cpu);
+		ni_write_packet(buf_ptr, buf_ptr[PKT_PAYLOAD] + 2);
+		pktdrv_nstats[id].packets_out++;
+		/* a received packet keeps its source, so its credit is given back when it is freed */
+		buf_ptr[PKT_SOURCE_CPU] = source;
 	}
+	hf_pktfree(pkt);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Receives a message from a task without copying it (blocking receive).
+ *
+ * @param source_cpu is a pointer to a variable which will hold the source cpu
+ * @param source_port is a pointer to a variable which will hold the source port
+ * @param pkt is a pointer to a variable which will hold the first packet of the message
+ * @param size a pointer to a variable which will hold the size (in bytes) of the received message
+ * @param channel is the selected message channel of this message (must be the same as in the sender)
+ *
+ * @return ERR_OK when successful, ERR_COMM_UNFEASIBLE when no message queue (comm) was
+ * created and ERR_SEQ_ERROR when received packets are not in sequence, so the message
+ * is corrupted.
+ *
+ * Same as hf_recv(), but the packets of the message are lent to the calling task instead of being
+ * decoded to a buffer. The payload of each packet is accessed with PKT_DATA() and hf_pktnext(), and
+ * the packets must be returned to the pool with hf_pktfree() (or reused with hf_sendpkt()) as soon as
+ * possible, as they are not counted on the task queue anymore.
+ */
+int32_t hf_recvpkt(uint16_t *source_cpu, uint16_t *source_port, uint16_t **pkt, uint16_t *size, uint16_t channel)
+{
+	uint16_t id, seq = 0;
+	uint32_t status;
+	int32_t error = ERR_OK;
+	uint16_t *buf_ptr;
+
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
+
+	*pkt = ni_take_message(id, channel);
+
+	*source_cpu = (*pkt)[PKT_SOURCE_CPU];
+	*source_port = (*pkt)[PKT_SOURCE_PORT];
+	*size = (*pkt)[PKT_MSG_SIZE];
+
+	for (buf_ptr = *pkt; buf_ptr; buf_ptr = PKT_LINK(buf_ptr))
+		if (buf_ptr[PKT_SEQ] != ++seq)
+			error = ERR_SEQ_ERROR;
+
+	status = _di();
+	pktdrv_frags[id] -= seq;
+	_ei(status);
 
 	return error;
 }
+
+/**
+ * @brief Returns the credits available to send packets to a processor.
+ *
+ * @param target_cpu is the target processor
+ *
+ * @return number of packets that can be sent to the target processor without blocking or ERR_INVALID_CPU
+ * when the target processor does not exist.
+ */
+int32_t hf_credits(uint16_t target_cpu)
+{
+	if (target_cpu >= NOC_WIDTH * NOC_HEIGHT)
+		return ERR_INVALID_CPU;
+
+	return pktdrv_credits[target_cpu];
+}
+
+/**
+ * @brief Returns traffic statistics of a port.
+ *
+ * @param port is the port of a task with a communication queue, or 0 for the statistics of the core
+ * @param stats is a pointer to a structure which will hold the statistics
+ *
+ * @return ERR_OK when successful and ERR_COMM_ERROR if no task is using the specified port.
+ *
+ * Statistics of a port are reset when its communication queue is created. Port 0 holds the packets
+ * dropped before a target task is known (malformed packets, packets to a port without a task and
+ * packets lost when the pool is empty). Counters are read without disabling interrupts, so the copy
+ * is not an atomic snapshot. The latency histogram counts messages by the time (in cycles) from the
+ * arrival of their first packet to their reception by the task. Bucket k holds latencies below
+ * 2^(k + NOC_LAT_SHIFT) cycles and the last bucket holds all larger latencies. The number of times
+ * a sender ran out of credits (and the time it was blocked) and the peak number of packets held by
+ * a receiver can be used to size NOC_PACKET_SLOTS, NOC_CREDITS and the task queues.
+ */
+int32_t hf_nocstats(uint16_t port, struct noc_stats *stats)
+{
+	int32_t k;
+
+	if (port){
+		for (k = 0; k < MAX_TASKS; k++)
+			if (pktdrv_ports[k] == port && pktdrv_tqueue[k]) break;
+		if (k == MAX_TASKS)
+			return ERR_COMM_ERROR;
+	}else{
+		k = MAX_TASKS;
+	}
+
+	memcpy(stats, &pktdrv_nstats[k], sizeof(struct noc_stats));
+
+	return ERR_OK;
+}
+
+/* writes a value to the simulator log */
+static void ni_log(uint32_t value)
+{
+#ifdef LOG_FACILITY
+	MemoryWrite(LOG_FACILITY, value);
+#else
+	if (value == 0xffffffff)
+		dprintf("\n");
+	else if (value == 0xfffffffe)
+		dprintf("#");
+	else
+		dprintf("%d\t", value);
+#endif
+}
+
+/**
+ * @brief Dumps traffic statistics of the core and of all ports to the simulator log.
+ *
+ * One line is written for the core (port 0) and for each port, starting with a '#' mark and
+ * followed by the cpu, the port and the fields of struct noc_stats, in order (packets in and out,
+ * credit stalls and stall time, messages in, drops by reason, queue and held packets peaks and
+ * the latency histogram). Values are written to LOG_FACILITY, which costs a single store each, so
+ * this may be called periodically instead of printing from the interrupt handler. If NOC_STATS_PERIOD
+ * is set, a task started with the first communication queue calls it every NOC_STATS_PERIOD ms.
+ * Must be called from task context.
+ */
+void hf_nocstats_dump(void)
+{
+	struct noc_stats *st;
+	int32_t i, k;
+
+	for (k = MAX_TASKS; k >= 0; k--){
+		if (k < MAX_TASKS && pktdrv_tqueue[k] == NULL)
+			continue;
+
+		st = &pktdrv_nstats[k];
+		ni_log(0xfffffffe);
+		ni_log(hf_cpuid());
+		ni_log(k < MAX_TASKS ? pktdrv_ports[k] : 0);
+		ni_log(st->packets_in);
+		ni_log(st->packets_out);
+		ni_log(st->stalls);
+		ni_log(st->stall_time);
+		ni_log(st->messages_in);
+		for (i = 0; i < NOC_DROP_REASONS; i++)
+			ni_log(st->drops[i]);
+		ni_log(st->queue_hwm);
+		ni_log(st->held_hwm);
+		for (i = 0; i < NOC_LAT_BUCKETS; i++)
+			ni_log(st->latency[i]);
+		ni_log(0xffffffff);
+	}
+}
+
+/* finds the stream of a task to / from a remote (cpu, port, channel). a new stream is set up if create is set. called with interrupts disabled */
+static struct ni_stream *ni_stream_get(struct ni_stream *table, uint16_t id, uint16_t cpu, uint16_t port, uint16_t channel, int32_t create)
+{
+	struct ni_stream *s, *free = NULL;
+	int32_t i;
+
+	for (i = 0; i < NOC_STREAMS; i++){
+		s = &table[i];
+		if (s->port == 0){
+			if (free == NULL)
+				free = s;
+			continue;
+		}
+		if (s->id == id && s->cpu == cpu && s->port == port && s->channel == channel)
+			return s;
+	}
+
+	if (create && free){
+		free->id = id;
+		free->cpu = cpu;
+		free->port = port;
+		free->channel = channel;
+		free->seq = 1;
+		free->acked = 0;
+		free->sack = 0;
+		free->refused = 0;
+	}
+
+	return create ? free : NULL;
+}
+
+/*
+ * takes an acknowledgement (cumulative sequence and selective bitmap) for a stream. a sender waiting for room on its
+ * window is woken up to release the messages acknowledged. called with interrupts disabled
+ */
+static void ni_ack_rx(uint16_t *buf_ptr)
+{
+	struct ni_stream *s;
+	int32_t k;
+
+	for (k = 0; k < MAX_TASKS; k++)
+		if (pktdrv_ports[k] == buf_ptr[PKT_HEADER_SIZE]) break;
+	if (k == MAX_TASKS)
+		return;
+
+	s = ni_stream_get(pktdrv_tx, k, buf_ptr[PKT_SOURCE_CPU], buf_ptr[PKT_SOURCE_PORT], buf_ptr[PKT_CHANNEL], 0);
+	if (s && !NI_SEQ_LT(buf_ptr[PKT_SEQ], s->acked) && NI_SEQ_LT(buf_ptr[PKT_SEQ], s->seq)){
+		s->acked = buf_ptr[PKT_SEQ];
+		s->sack = buf_ptr[PKT_HEADER_SIZE + 1];
+		if (pktdrv_wait[k] == NI_WAIT_ACK)
+			ni_unblock(k);
+	}
+}
+
+/*
+ * drops the fragments of a message of a stream pending reassembly, before the message is retransmitted. fragments
+ * of a message which lost others would be otherwise taken as part of the next message. the oldest sequence number
+ * the sender still holds is updated, so messages abandoned by the sender are skipped. called with interrupts disabled
+ */
+static void ni_reset_rx(uint16_t *buf_ptr)
+{
+	struct ni_stream *s;
+	int32_t k;
+
+	for (k = 0; k < MAX_TASKS; k++)
+		if (pktdrv_ports[k] == buf_ptr[PKT_HEADER_SIZE]) break;
+	if (k == MAX_TASKS)
+		return;
+
+	ni_reasm_drop(k, buf_ptr[PKT_SOURCE_CPU], buf_ptr[PKT_SOURCE_PORT], buf_ptr[PKT_CHANNEL]);
+
+	s = ni_stream_get(pktdrv_rx, k, buf_ptr[PKT_SOURCE_CPU], buf_ptr[PKT_SOURCE_PORT], buf_ptr[PKT_CHANNEL], 0);
+	if (s && NI_SEQ_LT(s->seq, buf_ptr[PKT_HEADER_SIZE + 1])){
+		s->seq = buf_ptr[PKT_HEADER_SIZE + 1];
+		ni_wakeup(k, s->channel);
+	}
+}
+
+/*
+ * forgets a stream closed by the sender, once all its messages were acknowledged (or refused). copies of its
+ * messages still on the task queue or pending reassembly are dropped, as they would be taken as messages of a
+ * new stream. called with interrupts disabled
+ */
+static void ni_close_rx(uint16_t *buf_ptr)
+{
+	struct ni_stream *s;
+	struct queue *q;
+	uint16_t *p;
+	int32_t i, j, k;
+
+	for (k = 0; k < MAX_TASKS; k++)
+		if (pktdrv_ports[k] == buf_ptr[PKT_HEADER_SIZE]) break;
+	if (k == MAX_TASKS)
+		return;
+
+	s = ni_stream_get(pktdrv_rx, k, buf_ptr[PKT_SOURCE_CPU], buf_ptr[PKT_SOURCE_PORT], buf_ptr[PKT_CHANNEL], 0);
+	if (s)
+		s->port = 0;
+	ni_reasm_drop(k, buf_ptr[PKT_SOURCE_CPU], buf_ptr[PKT_SOURCE_PORT], buf_ptr[PKT_CHANNEL]);
+
+	q = pktdrv_tqueue[k];
+	for (i = 0; i < hf_queue_count(q); ){
+		p = hf_queue_get(q, i);
+		if (p[PKT_CHANNEL] == buf_ptr[PKT_CHANNEL] && p[PKT_SOURCE_CPU] == buf_ptr[PKT_SOURCE_CPU] &&
+			p[PKT_SOURCE_PORT] == buf_ptr[PKT_SOURCE_PORT] && p[PKT_MSG_SIZE] >= NOC_ACK_HEADER){
+			for (j = i; j > 0; j--)
+				hf_queue_swap(q, j, j - 1);
+			ni_release(k, hf_queue_remhead(q));
+		}else{
+			i++;
+		}
+	}
+}
+
+/* the receiver had no room for a stream: its messages in flight are dropped by ni_window_release(). called with interrupts disabled */
+static void ni_refuse_rx(uint16_t *buf_ptr)
+{
+	struct ni_stream *s;
+	int32_t k;
+
+	for (k = 0; k < MAX_TASKS; k++)
+		if (pktdrv_ports[k] == buf_ptr[PKT_HEADER_SIZE]) break;
+	if (k == MAX_TASKS)
+		return;
+
+	s = ni_stream_get(pktdrv_tx, k, buf_ptr[PKT_SOURCE_CPU], buf_ptr[PKT_SOURCE_PORT], buf_ptr[PKT_CHANNEL], 0);
+	if (s){
+		s->refused = 1;
+		if (pktdrv_wait[k] == NI_WAIT_ACK)
+			ni_unblock(k);
+	}
+}
+
+/* sends a control packet of a stream (acknowledgement, reset, close or refusal) to the remote port */
+static void ni_ctrl_send(struct ni_stream *s, uint16_t port, uint16_t seq, uint16_t sack)
+{
+	uint16_t out_buf[NOC_PACKET_SIZE];
+
+	out_buf[PKT_TARGET_CPU] = (NOC_COLUMN(s->cpu) << 4) | NOC_LINE(s->cpu);
+	out_buf[PKT_PAYLOAD] = NI_FLITS(2 * sizeof(uint16_t)) - 2;
+	out_buf[PKT_SOURCE_CPU] = hf_cpuid();
+	out_buf[PKT_SOURCE_PORT] = pktdrv_ports[s->id];
+	out_buf[PKT_TARGET_PORT] = port;
+	out_buf[PKT_MSG_SIZE] = 2 * sizeof(uint16_t);
+	out_buf[PKT_SEQ] = seq;
+	out_buf[PKT_CHANNEL] = s->channel;
+	out_buf[PKT_HEADER_SIZE] = s->port;
+	out_buf[PKT_HEADER_SIZE + 1] = sack;
+
+	ni_write_packet(out_buf, NI_FLITS(2 * sizeof(uint16_t)));
+}
+
+/* sends an acknowledgement of a stream to the sender */
+static void ni_ack_send(struct ni_stream *s, uint16_t sack)
+{
+	ni_ctrl_send(s, NOC_PORT_ACK, s->seq - 1, sack);
+}
+
+/* a copy of message i of the task queue (same stream and sequence) is held before it. called with interrupts disabled */
+static int32_t ni_held(struct queue *q, int32_t i)
+{
+	uint16_t *buf_ptr, *prev;
+	int32_t j;
+
+	buf_ptr = hf_queue_get(q, i);
+	for (j = 0; j < i; j++){
+		prev = hf_queue_get(q, j);
+		if (prev[PKT_CHANNEL] == buf_ptr[PKT_CHANNEL] && prev[PKT_SOURCE_CPU] == buf_ptr[PKT_SOURCE_CPU] &&
+			prev[PKT_SOURCE_PORT] == buf_ptr[PKT_SOURCE_PORT] && prev[PKT_MSG_SIZE] >= NOC_ACK_HEADER &&
+			prev[PKT_HEADER_SIZE] == buf_ptr[PKT_HEADER_SIZE])
+			return 1;
+	}
+
+	return 0;
+}
+
+/* bitmap of the messages of a stream held on the task queue after the next one expected. called with interrupts disabled */
+static uint16_t ni_sack(uint16_t id, struct ni_stream *s)
+{
+	uint16_t *buf_ptr, sack = 0;
+	int32_t i, j, k;
+
+	k = hf_queue_count(pktdrv_tqueue[id]);
+	for (i = 0; i < k; i++){
+		buf_ptr = hf_queue_get(pktdrv_tqueue[id], i);
+		if (buf_ptr[PKT_CHANNEL] != s->channel || buf_ptr[PKT_SOURCE_CPU] != s->cpu || buf_ptr[PKT_SOURCE_PORT] != s->port)
+			continue;
+		j = (int16_t)(buf_ptr[PKT_HEADER_SIZE] - s->seq) - 1;
+		if (j >= 0 && j < 16)
+			sack |= 1 << j;
+	}
+
+	return sack;
+}
+
+/* oldest message of a stream still in flight, or the next one to be sent */
+static uint16_t ni_window_base(uint16_t id, struct ni_stream *s)
+{
+	struct ni_window *w;
+	uint16_t base;
+	int32_t i;
+
+	base = s->seq;
+	for (i = 0; i < NOC_WINDOW; i++){
+		w = &pktdrv_window[id][i];
+		if (w->buf && w->stream == s && NI_SEQ_LT(w->seq, base))
+			base = w->seq;
+	}
+
+	return base;
+}
+
+/* a message of the stream is in the window of its task. called with interrupts disabled */
+static int32_t ni_stream_flying(struct ni_stream *s)
+{
+	int32_t i;
+
+	if (pktdrv_window[s->id] == NULL)
+		return 0;
+	for (i = 0; i < NOC_WINDOW; i++)
+		if (pktdrv_window[s->id][i].buf && pktdrv_window[s->id][i].stream == s)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * frees a stream of the sender which is idle (all messages acknowledged) or refused by the receiver, returning a
+ * copy of it on closed. the receiver must be told with ni_stream_close(). called with interrupts disabled
+ */
+static int32_t ni_stream_reclaim(struct ni_stream *s, struct ni_stream *closed)
+{
+	if (s->port == 0 || ni_stream_flying(s) || (!s->refused && (uint16_t)(s->acked + 1) != s->seq))
+		return 0;
+
+	*closed = *s;
+	s->port = 0;
+
+	return 1;
+}
+
+/* tells the receiver to forget a stream reclaimed by the sender */
+static void ni_stream_close(struct ni_stream *closed)
+{
+	ni_ctrl_send(closed, NOC_PORT_CLOSE, closed->seq, 0);
+}
+
+/* (re)sends a message of the window of task id, updating the base sequence of its transport header */
+static void ni_window_send(uint16_t id, struct ni_window *w)
+{
+	struct noc_iovec iov;
+	uint16_t base;
+
+	base = ni_window_base(id, w->stream);
+	w->buf[2] = base >> 8;
+	w->buf[3] = base & 0xff;
+	w->time = _read_us();
+	iov.base = w->buf;
+	iov.len = w->size;
+	ni_sendv(id, w->stream->cpu, w->stream->port, &iov, 1, w->stream->channel);
+}
+
+/* a message of the window is acknowledged or its stream was refused, so it can be released. called with interrupts disabled */
+static int32_t ni_window_done(struct ni_window *w)
+{
+	return w->buf && !w->busy && (!NI_SEQ_LT(w->stream->acked, w->seq) || w->stream->refused);
+}
+
+/*
+ * releases acknowledged messages of the window of a task. messages of a stream refused by the receiver are dropped,
+ * closing the stream, and the failure is kept for hf_ackwait(). messages being sent are left for the next call.
+ * called by the task and by the transport task
+ */
+static void ni_window_release(uint16_t id)
+{
+	struct ni_window *w;
+	struct ni_stream closed;
+	uint32_t status;
+	int32_t i;
+	int8_t *buf;
+
+	for (i = 0; i < NOC_WINDOW; i++){
+		buf = NULL;
+		closed.port = 0;
+		status = _di();
+		if (pktdrv_window[id] == NULL){
+			_ei(status);
+			return;
+		}
+		w = &pktdrv_window[id][i];
+		if (ni_window_done(w)){
+			buf = w->buf;
+			w->buf = NULL;
+			if (NI_SEQ_LT(w->stream->acked, w->seq)){
+				ni_stream_reclaim(w->stream, &closed);
+				pktdrv_ackerr[id] = ERR_COMM_BUSY;
+			}
+		}
+		_ei(status);
+		if (buf)
+			hf_free(buf);
+		if (closed.port)
+			ni_stream_close(&closed);
+	}
+}
+
+/*
+ * retransmits the messages of the window of a task which are not acknowledged after NOC_RTO ms. messages reported as
+ * held by the receiver (selectively acknowledged) are retransmitted only after 4 * NOC_RTO ms, as the receiver may
+ * still drop them. a message is dropped after NOC_RETRIES retransmissions, and the failure is kept for hf_ackwait().
+ * a retransmitted message of several packets is preceded by a reset of the reassembly of the stream on the receiver,
+ * as some of its fragments may be pending there. called by the transport task only
+ */
+static void ni_window_poll(uint16_t id)
+{
+	struct ni_window *w;
+	struct ni_stream reset;
+	uint32_t status;
+	uint16_t acked, seq, base;
+	int32_t i, k, held;
+	int8_t *buf;
+
+	ni_window_release(id);
+
+	for (i = 0; i < NOC_WINDOW; i++){
+		status = _di();
+		if (pktdrv_window[id] == NULL){
+			_ei(status);
+			return;
+		}
+		w = &pktdrv_window[id][i];
+		if (w->buf == NULL || w->busy || ni_window_done(w)){
+			_ei(status);
+			continue;
+		}
+
+		acked = w->stream->acked;
+		k = (int16_t)(w->seq - acked) - 2;
+		held = k >= 0 && k < 16 && (w->stream->sack & (1 << k));
+		if (_read_us() - w->time < (held ? 4 * NOC_RTO : NOC_RTO) * 1000){
+			_ei(status);
+			continue;
+		}
+
+		if (++w->retries > NOC_RETRIES){
+			buf = w->buf;
+			w->buf = NULL;
+			reset = *w->stream;
+			seq = w->seq;
+			base = ni_window_base(id, w->stream);
+			pktdrv_ackerr[id] = ERR_COMM_TIMEOUT;
+			_ei(status);
+			hf_free(buf);
+			ni_ctrl_send(&reset, NOC_PORT_RESET, seq, base);
+			continue;
+		}
+		w->busy = 1;
+		_ei(status);
+
+		if (!held && ni_packets(w->size) > 1)
+			ni_ctrl_send(w->stream, NOC_PORT_RESET, w->seq, ni_window_base(id, w->stream));
+		ni_window_send(id, w);
+
+		status = _di();
+		w->busy = 0;
+		_ei(status);
+	}
+}
+
+/*
+ * drives the retransmission of messages sent with hf_sendack(), polling the windows of all tasks every NOC_RTO / 2 ms.
+ * senders blocked on a full window (or on hf_ackwait()) are woken up on each round, so they check their timeouts
+ */
+static void ni_transport_task(void)
+{
+	uint32_t status, ticks;
+	int32_t i;
+
+	ticks = ni_ticks(NOC_RTO / 2);
+	for (;;){
+		hf_delay(hf_selfid(), ticks);
+		for (i = 0; i < MAX_TASKS; i++){
+			if (pktdrv_window[i] == NULL)
+				continue;
+			ni_window_poll(i);
+			status = _di();
+			if (pktdrv_wait[i] == NI_WAIT_ACK)
+				ni_unblock(i);
+			_ei(status);
+		}
+	}
+}
+
+/**
+ * @brief Receives a message from a task (blocking receive) with acknowledgement.
+ *
+ * @param source_cpu is a pointer to a variable which will hold the source cpu
+ * @param source_port is a pointer to a variable which will hold the source port
+ * @param buf is a pointer to a buffer to hold the received message
+ * @param size a pointer to a variable which will hold the size (in bytes) of the received message
+ * @param channel is the selected message channel of this message (must be the same as in the sender)
+ *
+ * @return ERR_OK when successful and ERR_COMM_UNFEASIBLE when no message queue (comm) was created.
+ *
+ * Messages sent with hf_sendack() carry a transport header with a sequence number, the oldest sequence
+ * number the sender still holds and a checksum (CRC16) of the message. Messages of each sender (stream)
+ * are returned in sequence order: messages which arrive ahead of a missing one are kept on the task queue,
+ * duplicates and corrupted messages (e.g. built from fragments of different messages, after a fragment is
+ * lost) are dropped and sequence numbers abandoned by the sender are skipped. Dropping a corrupted message
+ * clears the bitmap of held messages on the sender, as the message may have been reported. After a message is received,
+ * an acknowledgement is sent to the sender, holding the sequence number of the last message received in
+ * order (cumulative) and a bitmap of the following 16 messages already held. When there are no free streams
+ * (NOC_STREAMS per core) for a new sender, its message is refused and the sender is told, so hf_sendack()
+ * reports ERR_COMM_BUSY. Streams are freed when their senders close them. This routine must be used
+ * exclusively with hf_sendack() on the channel.
+ */
+int32_t hf_recvack(uint16_t *source_cpu, uint16_t *source_port, int8_t *buf, uint16_t *size, uint16_t channel)
+{
+	struct queue *q;
+	struct ni_stream *s = NULL, *dup, refuse;
+	uint16_t id, seq, mseq, base, sack, crc = 0;
+	uint32_t status;
+	int32_t i, j, k, p, error;
+	uint16_t *buf_ptr, *next;
+
+	id = hf_selfid();
+	q = pktdrv_tqueue[id];
+	if (q == NULL) return ERR_COMM_UNFEASIBLE;
+
+	do {
+		status = _di();
+		while (1){
+			dup = NULL;
+			k = hf_queue_count(q);
+			for (i = 0; i < k; i++){
+				buf_ptr = hf_queue_get(q, i);
+				if (buf_ptr[PKT_CHANNEL] != channel)
+					continue;
+
+				s = ni_stream_get(pktdrv_rx, id, buf_ptr[PKT_SOURCE_CPU], buf_ptr[PKT_SOURCE_PORT], channel, 1);
+				if (s == NULL || buf_ptr[PKT_MSG_SIZE] < NOC_ACK_HEADER)
+					break;
+
+				mseq = buf_ptr[PKT_HEADER_SIZE];
+				base = buf_ptr[PKT_HEADER_SIZE + 1];
+				if (NI_SEQ_LT(s->seq, base))
+					s->seq = base;
+				if (mseq == s->seq)
+					break;
+				if (NI_SEQ_LT(mseq, s->seq) || ni_held(q, i)){
+					dup = s;
+					break;
+				}
+			}
+
+			if (i < k){
+				for (j = i; j > 0; j--)
+					hf_queue_swap(q, j, j - 1);
+				buf_ptr = hf_queue_remhead(q);
+				if (s && dup == NULL && buf_ptr[PKT_MSG_SIZE] >= NOC_ACK_HEADER){
+					ni_latency(id, buf_ptr);
+					break;
+				}
+				refuse.id = id;
+				refuse.cpu = buf_ptr[PKT_SOURCE_CPU];
+				refuse.port = buf_ptr[PKT_SOURCE_PORT];
+				refuse.channel = channel;
+				mseq = buf_ptr[PKT_MSG_SIZE] >= NOC_ACK_HEADER ? buf_ptr[PKT_HEADER_SIZE] : 0;
+				ni_release(id, buf_ptr);
+				if (dup){
+					sack = ni_sack(id, dup);
+					_ei(status);
+					ni_ack_send(dup, sack);
+					status = _di();
+				}else if (s == NULL){
+					_ei(status);
+					ni_ctrl_send(&refuse, NOC_PORT_REFUSE, mseq, 0);
+					status = _di();
+				}
+				continue;
+			}
+
+			_ei(status);
+			ni_credit_flush(1);
+			status = _di();
+			if (hf_queue_count(q) != k)
+				continue;
+			ni_block(id, channel, &status);
+		}
+		_ei(status);
+
+		*source_cpu = buf_ptr[PKT_SOURCE_CPU];
+		*source_port = buf_ptr[PKT_SOURCE_PORT];
+		*size = buf_ptr[PKT_MSG_SIZE] - NOC_ACK_HEADER;
+		crc = buf_ptr[PKT_HEADER_SIZE + 2];
+		seq = 0;
+		p = 0;
+		error = ERR_OK;
+
+		while (buf_ptr){
+			if (buf_ptr[PKT_SEQ] != ++seq)
+				error = ERR_SEQ_ERROR;
+
+			for (i = PKT_HEADER_SIZE; i < NOC_PACKET_SIZE && p < *size + NOC_ACK_HEADER; i++, p += 2){
+				if (p >= NOC_ACK_HEADER)
+					buf[p - NOC_ACK_HEADER] = (uint8_t)(buf_ptr[i] >> 8);
+				if (p + 1 >= NOC_ACK_HEADER && p + 1 < *size + NOC_ACK_HEADER)
+					buf[p + 1 - NOC_ACK_HEADER] = (uint8_t)(buf_ptr[i] & 0xff);
+			}
+			next = PKT_LINK(buf_ptr);
+			status = _di();
+			ni_free(buf_ptr);
+			pktdrv_frags[id]--;
+			_ei(status);
+			buf_ptr = next;
+		}
+		if (error == ERR_OK && hf_crc16(buf, *size) == crc)
+			break;
+		ni_ack_send(s, 0);
+	} while (1);
+
+	status = _di();
+	s->seq++;
+	sack = ni_sack(id, s);
+	_ei(status);
+
+	ni_ack_send(s, sack);
+	ni_credit_flush(NOC_CREDIT_BATCH);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Sends a message to a task with acknowledgement (reliable transport).
+ *
+ * @param target_cpu is the target processor
+ * @param target_port is the target task port
+ * @param buf is a pointer to a buffer that holds the message
+ * @param size is the size (in bytes) of the message
+ * @param channel is the selected message channel of this message (must be the same as in the receiver)
+ * @param timeout is the time (in ms) that the sender will wait for room on its window of messages in flight
+ *
+ * @return ERR_OK when the message was queued on the window, ERR_COMM_UNFEASIBLE when no message queue (comm) was
+ * created or the message does not fit, ERR_INVALID_CPU when the target processor does not exist, ERR_COMM_BUSY when
+ * there are no free streams, ERR_OUT_OF_MEMORY when the message cannot be kept for retransmission and
+ * ERR_COMM_TIMEOUT on timeout. Failures of messages already in flight are reported by hf_ackwait().
+ *
+ * This is a sliding window protocol. Each (target cpu, port, channel) is a stream, and its messages are numbered
+ * in sequence. A copy of the message is kept and the message is sent, so up to NOC_WINDOW messages of the task may
+ * be in flight, without waiting for the round trip of acknowledgements. Messages are released when acknowledged by
+ * the receiver (cumulative acknowledgement), and a message not acknowledged (either cumulatively or as held by the
+ * receiver) after NOC_RTO ms is retransmitted. Unlike a stop-and-wait transport, this routine returns as soon as the
+ * message is queued, and timeout only limits the wait for room on the window. The task is blocked while the window
+ * is full, until an acknowledgement arrives. Retransmissions are driven by a driver task (NoC transport), spawned on
+ * the first call, so they go on while the sender does other work. A task must call hf_ackwait() to make sure its
+ * messages were delivered. Streams with all messages acknowledged are closed and reused when there are no free
+ * streams. This routine should be used exclusively with hf_recvack().
+ */
+int32_t hf_sendack(uint16_t target_cpu, uint16_t target_port, int8_t *buf, uint16_t size, uint16_t channel, uint32_t timeout)
+{
+	struct ni_stream *s, closed;
+	struct ni_window *w = NULL, *window;
+	uint16_t id, crc;
+	uint32_t status, time;
+	int32_t i;
+	int8_t *copy;
+
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
+	if (target_cpu >= NOC_WIDTH * NOC_HEIGHT) return ERR_INVALID_CPU;
+	if (size > 0xffff - NOC_ACK_HEADER) return ERR_COMM_UNFEASIBLE;
+
+	if (pktdrv_window[id] == NULL){
+		window = hf_malloc(sizeof(struct ni_window) * NOC_WINDOW);
+		if (window == NULL) return ERR_OUT_OF_MEMORY;
+		memset(window, 0, sizeof(struct ni_window) * NOC_WINDOW);
+		pktdrv_window[id] = window;
+		if (pktdrv_xport_task == 0)
+			pktdrv_xport_task = hf_spawn(ni_transport_task, 0, 0, 0, "NoC transport", 1024);
+	}
+
+	/* only this task fills free slots, so a slot found free stays free */
+	time = _read_us() / 1000;
+	while (1){
+		ni_window_release(id);
+		status = _di();
+		for (i = 0; i < NOC_WINDOW; i++)
+			if (pktdrv_window[id][i].buf == NULL || ni_window_done(&pktdrv_window[id][i])) break;
+		if (i < NOC_WINDOW && pktdrv_window[id][i].buf == NULL){
+			_ei(status);
+			w = &pktdrv_window[id][i];
+			break;
+		}
+		if (((_read_us() / 1000) - time) > timeout){
+			_ei(status);
+			return ERR_COMM_TIMEOUT;
+		}
+		if (i == NOC_WINDOW)
+			ni_block(id, NI_WAIT_ACK, &status);
+		_ei(status);
+	}
+
+	copy = hf_malloc(size + NOC_ACK_HEADER);
+	if (copy == NULL) return ERR_OUT_OF_MEMORY;
+
+	/* the stream is taken along with the window slot, so it is never seen idle (and reclaimed) in between */
+	closed.port = 0;
+	status = _di();
+	s = ni_stream_get(pktdrv_tx, id, target_cpu, target_port, channel, 1);
+	for (i = 0; s == NULL && i < NOC_STREAMS; i++)
+		if (ni_stream_reclaim(&pktdrv_tx[i], &closed))
+			s = ni_stream_get(pktdrv_tx, id, target_cpu, target_port, channel, 1);
+	if (s){
+		w->stream = s;
+		w->seq = s->seq++;
+		w->buf = copy;
+		w->busy = 1;
+	}
+	_ei(status);
+	if (closed.port)
+		ni_stream_close(&closed);
+	if (s == NULL){
+		hf_free(copy);
+		return ERR_COMM_BUSY;
+	}
+
+	w->size = size + NOC_ACK_HEADER;
+	w->retries = 0;
+	crc = hf_crc16(buf, size);
+	w->buf[0] = w->seq >> 8;
+	w->buf[1] = w->seq & 0xff;
+	w->buf[4] = crc >> 8;
+	w->buf[5] = crc & 0xff;
+	memcpy(w->buf + NOC_ACK_HEADER, buf, size);
+	ni_window_send(id, w);
+
+	status = _di();
+	w->busy = 0;
+	_ei(status);
+
+	return ERR_OK;
+}
+
+/**
+ * @brief Waits for the acknowledgement of all messages sent with hf_sendack().
+ *
+ * @param timeout is the time (in ms) to wait
+ *
+ * @return ERR_OK when all messages were acknowledged, ERR_COMM_UNFEASIBLE when no message queue (comm) was
+ * created, ERR_COMM_BUSY when a message was refused by the receiver (no free streams) and ERR_COMM_TIMEOUT on
+ * timeout or when a message was dropped after NOC_RETRIES retransmissions.
+ *
+ * The task is blocked until its window is empty. Failures of messages sent since the last call are reported once
+ * all messages are released, and are cleared.
+ */
+int32_t hf_ackwait(uint32_t timeout)
+{
+	uint16_t id;
+	uint32_t status, time;
+	int32_t i, error;
+
+	id = hf_selfid();
+	if (pktdrv_tqueue[id] == NULL) return ERR_COMM_UNFEASIBLE;
+	if (pktdrv_window[id] == NULL) return ERR_OK;
+
+	time = _read_us() / 1000;
+	while (1){
+		ni_window_release(id);
+		status = _di();
+		for (i = 0; i < NOC_WINDOW; i++)
+			if (pktdrv_window[id][i].buf) break;
+		if (i == NOC_WINDOW){
+			error = pktdrv_ackerr[id];
+			pktdrv_ackerr[id] = ERR_OK;
+			_ei(status);
+			return error;
+		}
+		if (((_read_us() / 1000) - time) > timeout){
+			_ei(status);
+			return ERR_COMM_TIMEOUT;
+		}
+		for (i = 0; i < NOC_WINDOW; i++)
+			if (ni_window_done(&pktdrv_window[id][i])) break;
+		if (i == NOC_WINDOW)
+			ni_block(id, NI_WAIT_ACK, &status);
+		_ei(status);
+	}
+}
@@ -12,8 +12,10 @@
  *
  * A basic RPC mechanism on top of the Network-on-Chip primitives. This driver implements
  * the RPC semantics for remote calls in a NoC environment. Callbacks can be registered and
- * the driver waits for remote calls. Remote calls are placed on a queue, and handled in
- * first-come-first-served (FIFO) order by the noc_rpcdrv_service thread.
+ * the driver waits for remote calls. Remote calls are received by the noc_rpcdrv_service thread
+ * and placed on a queue of jobs, in first-come-first-served (FIFO) order. A pool of RPC_WORKERS
+ * worker threads takes jobs from this queue, so independent procedures run concurrently and a
+ * long call does not hold the others back.
  */
 
 #include <hellfire.h>
@@ -28,93 +30,247 @@
  * @return ERR_OK.
  * 
  * This is called when RPC packets arrive. This routine just places the packet (pointer to
- * a buffer taken from the NoC message queue pool) on the RPC thread message queue. On error
- * (queue full), the pointer is put back to the NoC pool. TODO: treat RPC service as a critical
- * event? The RR scheduler is behaving ok, but this is not enough!
+ * a buffer taken from the NoC message queue pool) on the RPC thread message queue and unblocks
+ * the RPC thread if it is waiting for calls. On error (queue full), the pointer is put back to
+ * the NoC pool.
  */
 static int32_t rpc_callback(uint16_t *buf_ptr)
 {
 	int32_t rpc_driver;
 	
-	if (hf_queue_addtail(pktdrv_tqueue[noc_rpcdrv.thread_id], buf_ptr)){
+	if (ni_deliver(noc_rpcdrv.thread_id, buf_ptr) == ERR_COMM_BUSY)
 		kprintf("\nKERNEL: NoC RPC service queue full!");
-		hf_queue_addtail(pktdrv_queue, buf_ptr);
-	} else {
-/*		krnl_tcb[noc_rpcdrv.thread_id].critical = 1; */
-	}
 	
 	return ERR_OK;
 }
 
+/**
+ * @brief Procedure table slot of a prognum / procnum pair.
+ */
+static uint32_t rpc_hash(uint32_t prognum, uint32_t procnum)
+{
+	uint32_t h;
+	
+	h = (prognum * 0x9e3779b1) ^ procnum;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	
+	return h & (RPC_PROC_SLOTS - 1);
+}
+
+/**
+ * @brief Looks for a registered procedure.
+ * 
+ * @param prognum is the program number.
+ * @param procnum is the procedure number.
+ * 
+ * @return a pointer to the procedure entry, or NULL if not registered.
+ * 
+ * The procedure table is an open addressing hash table (linear probing) keyed on the
+ * prognum / procnum pair. Entries are never removed, so an empty slot ends the search.
+ */
+struct proc_param_s *hf_lookup(uint32_t prognum, uint32_t procnum)
+{
+	struct proc_param_s *proc_param;
+	uint32_t h, i;
+	
+	h = rpc_hash(prognum, procnum);
+	for (i = 0; i < RPC_PROC_SLOTS; i++) {
+		proc_param = noc_rpcdrv.proc_table[(h + i) & (RPC_PROC_SLOTS - 1)];
+		if (!proc_param)
+			break;
+		if (proc_param->prognum == prognum && proc_param->procnum == procnum)
+			return proc_param;
+	}
+	
+	return NULL;
+}
+
+/**
+ * @brief Receives RPC calls from remote processors / threads.
+ *
+ * The service runs as a best effort task and waits (blocked) for messages on port 0xffff (special
+ * case on the NoC driver). Each message is taken from the reception queue as it is (a chain of
+ * packets of the shared pool, see hf_recvpkt()), placed on the queue of jobs, and a worker is
+ * signaled. Packets are given back to the pool by the worker, once the call is handled.
+ */
+static void noc_rpcdrv_service(void)
+{
+	uint16_t cpu, port, size;
+	uint16_t *pkt;
+	uint32_t status;
+	int32_t channel;
+	
+	hf_comm_create(hf_selfid(), 0xffff, 0);
+	
+	for (;;) {
+		channel = hf_recvwait();
+		if (channel >= 0) {
+			if (hf_recvpkt(&cpu, &port, &pkt, &size, channel) != ERR_OK) {
+				kprintf("\nKERNEL: RPC packet sequence error!");
+				hf_pktfree(pkt);
+				continue;
+			}
+			
+			if (size > sizeof(struct proc_pkt_s) + RPC_MAX_PARAM_SIZE) {
+				kprintf("\nKERNEL: RPC data > %d bytes, this is not right!", RPC_MAX_PARAM_SIZE);
+				hf_pktfree(pkt);
+				continue;
+			}
+			
+			status = _di();
+			hf_queue_addtail(noc_rpcdrv.jobs, pkt);
+			_ei(status);
+			hf_sempost(&noc_rpcdrv.pending);
+		}
+	}
+}
+
+/**
+ * @brief Runs a batch of calls.
+ * 
+ * @param in_pkt is the received message.
+ * @param out_pkt is the reply.
+ *
+ * A batch carries proc_hdr.records records, each made of a proc_rec_s header followed by the
+ * input parameters of a call (in_size bytes, padded to a multiple of 4 bytes). Calls are run in
+ * order, and the reply carries one record per call with its output parameters (or size 0 and
+ * an error code on fail). out_size of the reply header is set to the size of the packed records.
+ */
+static void rpc_run_batch(union proc_pkt_u *in_pkt, union proc_pkt_u *out_pkt)
+{
+	struct proc_param_s *proc_param;
+	struct proc_rec_s *in_rec, *out_rec;
+	int32_t i, p = 0, q = 0;
+	
+	if (in_pkt->proc_hdr.in_size > RPC_MAX_PARAM_SIZE)
+		in_pkt->proc_hdr.records = 0;
+	
+	for (i = 0; i < in_pkt->proc_hdr.records; i++) {
+		if (p + sizeof(struct proc_rec_s) > in_pkt->proc_hdr.in_size)
+			break;
+		in_rec = (struct proc_rec_s *)(in_pkt->proc_data + sizeof(struct proc_pkt_s) + p);
+		out_rec = (struct proc_rec_s *)(out_pkt->proc_data + sizeof(struct proc_pkt_s) + q);
+		if (p + sizeof(struct proc_rec_s) + RPC_REC_ALIGN(in_rec->size) > in_pkt->proc_hdr.in_size)
+			break;
+		
+		*out_rec = *in_rec;
+		out_rec->size = 0;
+		out_rec->ecode = -1;
+		
+		proc_param = hf_lookup(in_rec->prognum, in_rec->procnum);
+		if (proc_param && proc_param->in_size == in_rec->size &&
+		q + sizeof(struct proc_rec_s) + RPC_REC_ALIGN(proc_param->out_size) <= RPC_MAX_PARAM_SIZE) {
+			proc_param->proc_ptr((int8_t *)(in_rec + 1), (int8_t *)(out_rec + 1));
+			out_rec->size = proc_param->out_size;
+			out_rec->ecode = 0;
+		} else {
+			kprintf("\nKERNEL: RPC batch record %d failed!", i);
+		}
+		
+		p += sizeof(struct proc_rec_s) + RPC_REC_ALIGN(in_rec->size);
+		q += sizeof(struct proc_rec_s) + RPC_REC_ALIGN(out_rec->size);
+	}
+	
+	out_pkt->proc_hdr.records = i;
+	out_pkt->proc_hdr.out_size = q;
+}
+
 /**
  * @brief Handles RPC calls from remote processors / threads.
  *
- * The service runs as a best effort task and waits for messages on port 0xffff (special case
- * on the NoC driver. Data is received (composed of a header containing program and procedure
- * identification and procedure parameters / size), and the remote call is handled:
+ * Workers wait (blocked) for jobs placed on the queue by noc_rpcdrv_service(). Data is received
+ * (composed of a header containing program and procedure identification and procedure parameters / size),
+ * and the remote call is handled:
  * 
- * 1) look for the prognum / procnum pair in a list (for a registered procedure);
- * 2) compare input and output parameter sizes, which should match;
- * 3) take packet data and fill input parameters;
+ * 1) take packet data and fill input parameters;
+ * 2) look for the prognum / procnum pair in the procedure table (for a registered procedure);
+ * 3) compare input and output parameter sizes, which should match;
  * 4) call the procedure, passing input and output parameters by reference;
- * 5) copy output parameters to packet data, and send it back or send an error code on fail.
+ * 5) send output parameters back or send an error code on fail.
  *
- * Data is sent structured as:
+ * Input and output parameters are kept on the stack of the worker, so each invocation has its own
+ * buffers. Data is sent structured as:
  * - 4 bytes (prognum)
  * - 4 bytes (procnum)
  * - 2 bytes (in_size)
  * - 2 bytes (out_size)
  * - 4 bytes (ecode)
+ * - 2 bytes (call_id)
+ * - 2 bytes (records)
  * - (output parameters)
+ *
+ * The header is sent back as received, so the caller can match the reply (call_id) to
+ * the call it has issued. A message which size does not match the header and in_size is
+ * rejected with an error code. If records is not zero, the message is a batch of calls,
+ * handled by rpc_run_batch().
  */
-static void noc_rpcdrv_service(void)
+static void noc_rpcdrv_worker(void)
 {
-	union proc_pkt_u proc_pkt;
+	union proc_pkt_u in_pkt, out_pkt;
 	struct proc_param_s *proc_param;
-	uint16_t cpu, port, size;
-	int32_t channel, i, k;
+	uint16_t cpu, port, size, channel, *pkt, *buf_ptr;
+	uint32_t status;
+	int32_t k, p;
+	static int32_t workers = 0;
 	
-	hf_comm_create(hf_selfid(), 0xffff, 0);
+	status = _di();
+	k = workers++;
+	_ei(status);
+	
+	hf_comm_create(hf_selfid(), RPC_WPORT + k, 1);
 	
 	for (;;) {
-		channel = hf_recvprobe();
-		if (channel >= 0) {
-			hf_recv(&cpu, &port, proc_pkt.proc_data, &size, channel);
-
-			if (size > RPC_MAX_PARAM_SIZE) {
-				kprintf("\nKERNEL: RPC data > %d bytes, this is not right!", RPC_MAX_PARAM_SIZE);
-				continue;
-			}
-			
-			k = hf_list_count(noc_rpcdrv.proc_list);
-			for (i = 0; i < k; i++) {
-				proc_param = hf_list_get(noc_rpcdrv.proc_list, i);
-				if (proc_param) {
-					if (proc_param->prognum == proc_pkt.proc_hdr.prognum &&
-					proc_param->procnum == proc_pkt.proc_hdr.procnum)
-						break;
-				}
-			}
-			
-			if (i < k) {
-				if (proc_param->in_size == proc_pkt.proc_hdr.in_size &&
-				proc_param->out_size == proc_pkt.proc_hdr.out_size) {
-					memcpy(proc_param->in_data, proc_pkt.proc_data + sizeof(struct proc_pkt_s), proc_param->in_size);
-					proc_param->proc_ptr(proc_param->in_data, proc_param->out_data);
-					memcpy(proc_pkt.proc_data + sizeof(struct proc_pkt_s), proc_param->out_data, proc_param->out_size);
-				} else {
-					kprintf("\nKERNEL: RPC parameters size mismatch!");
-					proc_pkt.proc_hdr.out_size = 0;
-					proc_pkt.proc_hdr.ecode = -1;
-				}
+		hf_semwait(&noc_rpcdrv.pending);
+		status = _di();
+		pkt = hf_queue_remhead(noc_rpcdrv.jobs);
+		_ei(status);
+		
+		cpu = pkt[PKT_SOURCE_CPU];
+		port = pkt[PKT_SOURCE_PORT];
+		size = pkt[PKT_MSG_SIZE];
+		channel = pkt[PKT_CHANNEL];
+		
+		for (p = 0, buf_ptr = pkt; buf_ptr && p < size; buf_ptr = hf_pktnext(buf_ptr), p += NOC_PAYLOAD_BYTES)
+			memcpy(in_pkt.proc_data + p, PKT_DATA(buf_ptr), size - p < NOC_PAYLOAD_BYTES ? size - p : NOC_PAYLOAD_BYTES);
+		hf_pktfree(pkt);
+		
+		out_pkt.proc_hdr = in_pkt.proc_hdr;
+		
+		if (size < sizeof(struct proc_pkt_s) || size != sizeof(struct proc_pkt_s) + in_pkt.proc_hdr.in_size) {
+			kprintf("\nKERNEL: RPC message size mismatch!");
+			out_pkt.proc_hdr.out_size = 0;
+			out_pkt.proc_hdr.ecode = -1;
+			out_pkt.proc_hdr.records = 0;
+			hf_send(cpu, port, out_pkt.proc_data, sizeof(struct proc_pkt_s), channel);
+			continue;
+		}
+		
+		if (in_pkt.proc_hdr.records) {
+			rpc_run_batch(&in_pkt, &out_pkt);
+			hf_send(cpu, port, out_pkt.proc_data, sizeof(struct proc_pkt_s) + out_pkt.proc_hdr.out_size, channel);
+			continue;
+		}
+		
+		proc_param = hf_lookup(in_pkt.proc_hdr.prognum, in_pkt.proc_hdr.procnum);
+		
+		if (proc_param) {
+			if (proc_param->in_size == in_pkt.proc_hdr.in_size &&
+			proc_param->out_size == in_pkt.proc_hdr.out_size) {
+				proc_param->proc_ptr(in_pkt.proc_data + sizeof(struct proc_pkt_s), out_pkt.proc_data + sizeof(struct proc_pkt_s));
 			} else {
-				kprintf("\nKERNEL: RPC prognum/procnum not found!");
-				proc_pkt.proc_hdr.out_size = 0;
-				proc_pkt.proc_hdr.ecode = -1;
+				kprintf("\nKERNEL: RPC parameters size mismatch!");
+				out_pkt.proc_hdr.out_size = 0;
+				out_pkt.proc_hdr.ecode = -1;
 			}
-			
-			hf_send(cpu, port, proc_pkt.proc_data, sizeof(struct proc_pkt_s) + proc_pkt.proc_hdr.out_size, channel);
+		} else {
+			kprintf("\nKERNEL: RPC prognum/procnum not found!");
+			out_pkt.proc_hdr.out_size = 0;
+			out_pkt.proc_hdr.ecode = -1;
 		}
+		
+		hf_send(cpu, port, out_pkt.proc_data, sizeof(struct proc_pkt_s) + out_pkt.proc_hdr.out_size, channel);
 	}
 }
 
@@ -123,13 +279,31 @@ static void noc_rpcdrv_service(void)
  * 
  * @return ERR_OK on success and ERR_ERROR on fail.
  *
- * Data structures related to the RPC driver are initialized, the RPC service thread is spawned
- * and the RPC callback is registered for incoming RPC packets.
+ * Data structures related to the RPC driver are initialized, the RPC service thread and the
+ * pool of workers are spawned and the RPC callback is registered for incoming RPC packets.
  */
 static int32_t noc_rpcdrv_init(void)
 {
-	noc_rpcdrv.proc_list = hf_list_init();
-	noc_rpcdrv.thread_id = hf_spawn(noc_rpcdrv_service, 0, 0, 0, "NoC RPC", RPC_MAX_PARAM_SIZE + RPC_STACK_SIZE);
+	int32_t i;
+	
+	for (i = 0; i < RPC_PROC_SLOTS; i++)
+		noc_rpcdrv.proc_table[i] = NULL;
+	noc_rpcdrv.jobs = hf_queue_create(NOC_PACKET_SLOTS);
+	if (!noc_rpcdrv.jobs || hf_seminit(&noc_rpcdrv.pending, 0)) {
+		kprintf("\nKERNEL: NoC RPC init failed");
+		
+		return ERR_ERROR;
+	}
+	
+	for (i = 0; i < RPC_WORKERS; i++) {
+		noc_rpcdrv.workers[i] = hf_spawn(noc_rpcdrv_worker, 0, 0, 0, "NoC RPC worker", 2 * sizeof(union proc_pkt_u) + RPC_STACK_SIZE);
+		if (noc_rpcdrv.workers[i] <= 0) {
+			kprintf("\nKERNEL: NoC RPC init failed");
+			
+			return ERR_ERROR;
+		}
+	}
+	noc_rpcdrv.thread_id = hf_spawn(noc_rpcdrv_service, 0, 0, 0, "NoC RPC", RPC_STACK_SIZE);
 
 	if (noc_rpcdrv.thread_id > 0) {
 		pktdrv_callback = rpc_callback;		
@@ -144,13 +318,12 @@ static int32_t noc_rpcdrv_init(void)
 }
 
 // -check if the RPC subsystem is initialized (hook registered to the NoC packet driver callback). if not, register it.
-// -compare the list of registered procedures to the prognum/procnum pair and abort if already used.
-// -add a list entry with prognum procnum, proc pointer and allocate in and out data structures (register it on the list)
+// -look for the prognum/procnum pair in the procedure table and abort if already used.
+// -fill an entry with prognum procnum and proc pointer, and place it on the first free slot of its probe sequence
 int32_t hf_register(uint32_t prognum, uint32_t procnum, int32_t (*pname)(int8_t *, int8_t *), uint16_t in_size, uint16_t out_size)
 {
-	int32_t i, k;
+	uint32_t h, i;
 	struct proc_param_s *proc_param;
-	int8_t *input, *output;
 	
 	if (in_size > RPC_MAX_PARAM_SIZE || out_size > RPC_MAX_PARAM_SIZE)
 		return -1;
@@ -160,62 +333,97 @@ int32_t hf_register(uint32_t prognum, uint32_t procnum, int32_t (*pname)(int8_t
 			return ERR_ERROR;
 	}
 	
-	k = hf_list_count(noc_rpcdrv.proc_list);
-	for (i = 0; i < k; i++) {
-		proc_param = hf_list_get(noc_rpcdrv.proc_list, i);
-		if (proc_param) {
-			if (proc_param->prognum == prognum && proc_param->procnum == procnum)
-				return ERR_ERROR;
-		}
-	}
+	if (hf_lookup(prognum, procnum))
+		return ERR_ERROR;
+	
+	h = rpc_hash(prognum, procnum);
+	for (i = 0; i < RPC_PROC_SLOTS; i++)
+		if (!noc_rpcdrv.proc_table[(h + i) & (RPC_PROC_SLOTS - 1)])
+			break;
+	
+	if (i == RPC_PROC_SLOTS)
+		return ERR_OUT_OF_MEMORY;
 	
 	proc_param = (struct proc_param_s *)hf_malloc(sizeof(struct proc_param_s));
-	input = (int8_t *)hf_malloc(in_size);
-	output = (int8_t *)hf_malloc(out_size);
-	if (!proc_param || !input || !output) return ERR_OUT_OF_MEMORY;
+	if (!proc_param) return ERR_OUT_OF_MEMORY;
 	
 	proc_param->prognum = prognum;
 	proc_param->procnum = procnum;
 	proc_param->proc_ptr = pname;
 	proc_param->in_size = in_size;
 	proc_param->out_size = out_size;
-	proc_param->in_data = input;
-	proc_param->out_data = output;
-	hf_list_append(noc_rpcdrv.proc_list, proc_param);
+	noc_rpcdrv.proc_table[(h + i) & (RPC_PROC_SLOTS - 1)] = proc_param;
 	
 	kprintf("\nKERNEL: RPC registered prognum %d procnum %d at %x (in size %d, out size %d)", prognum, procnum, (uint32_t)pname, in_size, out_size);
 	
 	return ERR_OK;
 }
 
+static struct rpc_call_s rpc_calls[RPC_MAX_PARALLEL_CALLS];
+static uint16_t rpc_call_id = 0;
+
+static void rpc_init(void)
+{
+	static volatile int8_t init = 0;
+	uint32_t status;
+	int32_t i;
+
+	status = _di();
+	if (!init) {
+		hf_mtxinit(&rpc_lock);
+		for (i = 0; i < RPC_MAX_PARALLEL_CALLS; i++)
+			rpc_calls[i].call_id = 0;
+		init = 1;
+	}
+	_ei(status);
+}
+
+static void rpc_header(union proc_pkt_u *proc_pkt, uint32_t prognum, uint32_t procnum, int8_t *in, uint16_t in_size, uint16_t out_size, uint16_t call_id)
+{
+	proc_pkt->proc_hdr.prognum = prognum;
+	proc_pkt->proc_hdr.procnum = procnum;
+	proc_pkt->proc_hdr.in_size = in_size;
+	proc_pkt->proc_hdr.out_size = out_size;
+	proc_pkt->proc_hdr.ecode = 0;
+	proc_pkt->proc_hdr.call_id = call_id;
+	proc_pkt->proc_hdr.records = 0;
+	memcpy(proc_pkt->proc_data + sizeof(struct proc_pkt_s), in, in_size);
+}
+
+static int32_t rpc_result(union proc_pkt_u *proc_pkt, int8_t *out, uint16_t out_size)
+{
+	if (proc_pkt->proc_hdr.ecode != 0)
+		return proc_pkt->proc_hdr.ecode;
+	
+	if (out_size != proc_pkt->proc_hdr.out_size)
+		return ERR_ERROR;
+		
+	memcpy(out, proc_pkt->proc_data + sizeof(struct proc_pkt_s), out_size);
+		
+	return ERR_OK;
+}
+
 // send data structured as:
 // 4 bytes (prognum)
 // 4 bytes (procnum)
 // 2 bytes (in_size)
 // 2 bytes (out_size)
 // 4 bytes (ecode)
+// 2 bytes (call_id)
+// 2 bytes (records)
 // (input parameters)
 int32_t hf_call(uint16_t cpu, uint32_t prognum, uint32_t procnum, int8_t *in, uint16_t in_size, int8_t *out, uint16_t out_size)
 {
 	union proc_pkt_u proc_pkt;
 	uint16_t rcpu, rport, rsize;
-	static volatile int8_t init = 0;
 	
 	if (in_size > RPC_MAX_PARAM_SIZE || out_size > RPC_MAX_PARAM_SIZE)
 		return ERR_ERROR;
 		
-	if (!init) {
-		hf_mtxinit(&rpc_lock);
-		init = 1;
-	}
+	rpc_init();
 	
 	hf_mtxlock(&rpc_lock);
-	proc_pkt.proc_hdr.prognum = prognum;
-	proc_pkt.proc_hdr.procnum = procnum;
-	proc_pkt.proc_hdr.in_size = in_size;
-	proc_pkt.proc_hdr.out_size = out_size;
-	proc_pkt.proc_hdr.ecode = 0;
-	memcpy(proc_pkt.proc_data + sizeof(struct proc_pkt_s), in, in_size);
+	rpc_header(&proc_pkt, prognum, procnum, in, in_size, out_size, 0);
 	
 	/* TODO: use a better / more resilient protocol!
 	 * this is a blocking primitive, and will hang if no response is received.
@@ -225,13 +433,219 @@ int32_t hf_call(uint16_t cpu, uint32_t prognum, uint32_t procnum, int8_t *in, ui
 	
 	hf_recv(&rcpu, &rport, proc_pkt.proc_data, &rsize, RPC_SCHANNEL - hf_cpuid());
 	
-	if (proc_pkt.proc_hdr.ecode != 0)
-		return proc_pkt.proc_hdr.ecode;
+	return rpc_result(&proc_pkt, out, out_size);
+}
+
+/**
+ * @brief Issues a remote procedure call without waiting for its reply.
+ * 
+ * @param cpu is the target processor.
+ * @param prognum is the program number.
+ * @param procnum is the procedure number.
+ * @param in is a pointer to the input parameters.
+ * @param in_size is the size of the input parameters.
+ * @param out is a pointer to the output parameters, filled by hf_wait().
+ * @param out_size is the size of the output parameters.
+ * 
+ * @return a call handle, ERR_ERROR on invalid sizes or ERR_COMM_BUSY if RPC_MAX_PARALLEL_CALLS
+ * calls are already in flight.
+ * 
+ * Each call in flight holds a slot of a table, and its reply is received on its own channel
+ * (RPC_ACHANNEL - slot), tagged with the call id. This way a task can issue calls to several
+ * processors (or several calls to the same processor) and gather the results later with hf_wait(),
+ * in any order. The out buffer must remain valid until the call is completed.
+ */
+int32_t hf_call_async(uint16_t cpu, uint32_t prognum, uint32_t procnum, int8_t *in, uint16_t in_size, int8_t *out, uint16_t out_size)
+{
+	union proc_pkt_u proc_pkt;
+	int32_t i, r;
 	
-	if (out_size != proc_pkt.proc_hdr.out_size)
+	if (in_size > RPC_MAX_PARAM_SIZE || out_size > RPC_MAX_PARAM_SIZE)
 		return ERR_ERROR;
 		
-	memcpy(out, proc_pkt.proc_data + sizeof(struct proc_pkt_s), out_size);
+	rpc_init();
+	
+	hf_mtxlock(&rpc_lock);
+	for (i = 0; i < RPC_MAX_PARALLEL_CALLS; i++)
+		if (rpc_calls[i].call_id == 0)
+			break;
+	
+	if (i == RPC_MAX_PARALLEL_CALLS) {
+		hf_mtxunlock(&rpc_lock);
 		
+		return ERR_COMM_BUSY;
+	}
+	
+	if (++rpc_call_id == 0)
+		rpc_call_id = 1;
+	rpc_calls[i].call_id = rpc_call_id;
+	rpc_calls[i].task_id = hf_selfid();
+	rpc_calls[i].cpu = cpu;
+	rpc_calls[i].out_size = out_size;
+	rpc_calls[i].out_data = out;
+	
+	rpc_header(&proc_pkt, prognum, procnum, in, in_size, out_size, rpc_call_id);
+	r = hf_send(cpu, RPC_PORT, proc_pkt.proc_data, sizeof(struct proc_pkt_s) + in_size, RPC_ACHANNEL - i);
+	if (r != ERR_OK) {
+		rpc_calls[i].call_id = 0;
+		hf_mtxunlock(&rpc_lock);
+		
+		return r;
+	}
+	hf_mtxunlock(&rpc_lock);
+	
+	return i;
+}
+
+/**
+ * @brief Waits for the completion of a call issued by hf_call_async().
+ * 
+ * @param handle is the call handle.
+ * 
+ * @return ERR_OK on success, ERR_ERROR on an invalid handle or size mismatch, or the error code
+ * returned by the remote end.
+ * 
+ * The calling task blocks until the reply of the call arrives. Replies with a different call id
+ * (stale ones) are discarded. Output parameters are copied to the buffer given on the call and
+ * the call slot is released.
+ */
+int32_t hf_wait(int32_t handle)
+{
+	union proc_pkt_u proc_pkt;
+	uint16_t rcpu, rport, rsize;
+	struct rpc_call_s *call;
+	int32_t r;
+	
+	if (handle < 0 || handle >= RPC_MAX_PARALLEL_CALLS)
+		return ERR_ERROR;
+	
+	call = &rpc_calls[handle];
+	if (call->call_id == 0 || call->task_id != hf_selfid())
+		return ERR_ERROR;
+	
+	do {
+		r = hf_recv(&rcpu, &rport, proc_pkt.proc_data, &rsize, RPC_ACHANNEL - handle);
+	} while (r == ERR_OK && (rcpu != call->cpu || proc_pkt.proc_hdr.call_id != call->call_id));
+	
+	if (r == ERR_OK)
+		r = rpc_result(&proc_pkt, call->out_data, call->out_size);
+	
+	hf_mtxlock(&rpc_lock);
+	call->call_id = 0;
+	hf_mtxunlock(&rpc_lock);
+	
+	return r;
+}
+
+/**
+ * @brief Initializes a batch of calls.
+ * 
+ * @param batch is a pointer to the batch.
+ */
+void hf_batch_init(struct rpc_batch_s *batch)
+{
+	batch->records = 0;
+	batch->in_size = 0;
+	batch->out_size = 0;
+}
+
+/**
+ * @brief Adds a call to a batch.
+ * 
+ * @param batch is a pointer to the batch.
+ * @param prognum is the program number.
+ * @param procnum is the procedure number.
+ * @param in is a pointer to the input parameters (copied to the batch).
+ * @param in_size is the size of the input parameters.
+ * @param out is a pointer to the output parameters, filled by hf_call_batch().
+ * @param out_size is the size of the output parameters.
+ * 
+ * @return ERR_OK on success and ERR_ERROR if the call does not fit in the batch (either
+ * RPC_MAX_BATCH calls or RPC_MAX_PARAM_SIZE bytes of the request or reply).
+ */
+int32_t hf_batch_add(struct rpc_batch_s *batch, uint32_t prognum, uint32_t procnum, int8_t *in, uint16_t in_size, int8_t *out, uint16_t out_size)
+{
+	struct proc_rec_s *rec;
+	
+	if (batch->records == RPC_MAX_BATCH ||
+	batch->in_size + sizeof(struct proc_rec_s) + RPC_REC_ALIGN(in_size) > RPC_MAX_PARAM_SIZE ||
+	batch->out_size + sizeof(struct proc_rec_s) + RPC_REC_ALIGN(out_size) > RPC_MAX_PARAM_SIZE)
+		return ERR_ERROR;
+	
+	rec = (struct proc_rec_s *)(batch->proc_pkt.proc_data + sizeof(struct proc_pkt_s) + batch->in_size);
+	rec->prognum = prognum;
+	rec->procnum = procnum;
+	rec->size = in_size;
+	rec->ecode = 0;
+	memcpy(rec + 1, in, in_size);
+	
+	batch->rec_size[batch->records] = out_size;
+	batch->rec_data[batch->records] = out;
+	batch->ecode[batch->records] = 0;
+	batch->records++;
+	batch->in_size += sizeof(struct proc_rec_s) + RPC_REC_ALIGN(in_size);
+	batch->out_size += sizeof(struct proc_rec_s) + RPC_REC_ALIGN(out_size);
+	
 	return ERR_OK;
 }
+
+/**
+ * @brief Calls a batch of procedures on a remote processor.
+ * 
+ * @param cpu is the target processor.
+ * @param batch is a pointer to the batch.
+ * 
+ * @return ERR_OK when all calls succeed, ERR_ERROR otherwise.
+ * 
+ * All calls of the batch are sent on a single message, run in order by the remote end and their
+ * results are sent back on a single reply. Output parameters of each call are copied to the buffer
+ * given to hf_batch_add() and the error code of each call is kept on batch->ecode[]. The batch is
+ * emptied, so it can be reused.
+ */
+int32_t hf_call_batch(uint16_t cpu, struct rpc_batch_s *batch)
+{
+	union proc_pkt_u *proc_pkt;
+	struct proc_rec_s *rec;
+	uint16_t rcpu, rport, rsize;
+	int32_t i, p = 0, r = ERR_OK;
+	
+	if (batch->records == 0)
+		return ERR_OK;
+	
+	rpc_init();
+	
+	proc_pkt = &batch->proc_pkt;
+	proc_pkt->proc_hdr.prognum = 0;
+	proc_pkt->proc_hdr.procnum = 0;
+	proc_pkt->proc_hdr.in_size = batch->in_size;
+	proc_pkt->proc_hdr.out_size = batch->out_size;
+	proc_pkt->proc_hdr.ecode = 0;
+	proc_pkt->proc_hdr.call_id = 0;
+	proc_pkt->proc_hdr.records = batch->records;
+	
+	hf_mtxlock(&rpc_lock);
+	hf_send(cpu, RPC_PORT, proc_pkt->proc_data, sizeof(struct proc_pkt_s) + batch->in_size, RPC_SCHANNEL - hf_cpuid());
+	hf_mtxunlock(&rpc_lock);
+	
+	hf_recv(&rcpu, &rport, proc_pkt->proc_data, &rsize, RPC_SCHANNEL - hf_cpuid());
+	
+	for (i = 0; i < batch->records; i++) {
+		rec = (struct proc_rec_s *)(proc_pkt->proc_data + sizeof(struct proc_pkt_s) + p);
+		if (i >= proc_pkt->proc_hdr.records || p + sizeof(struct proc_rec_s) > proc_pkt->proc_hdr.out_size) {
+			batch->ecode[i] = ERR_ERROR;
+		} else if (rec->ecode != 0 || rec->size != batch->rec_size[i]) {
+			batch->ecode[i] = rec->ecode ? rec->ecode : ERR_ERROR;
+		} else {
+			memcpy(batch->rec_data[i], rec + 1, rec->size);
+			batch->ecode[i] = ERR_OK;
+		}
+		if (batch->ecode[i] != ERR_OK)
+			r = ERR_ERROR;
+		if (i < proc_pkt->proc_hdr.records)
+			p += sizeof(struct proc_rec_s) + RPC_REC_ALIGN(rec->size);
+	}
+	
+	hf_batch_init(batch);
+	
+	return r;
+}
@@ -19,7 +19,7 @@
 #define TASK_READY			1		/*!< task ready to run (on run queue) */
 #define TASK_RUNNING			2		/*!< task running (only one task/core can be in this state, on run queue) */
 #define TASK_BLOCKED			3		/*!< task blocked, can be resumed later (on run queue) */
-#define TASK_DELAYED			4		/*!< task being delayed (on delay queue) */
+#define TASK_DELAYED			4		/*!< task being delayed (on the delay wheel) */
 #define TASK_WAITING			5		/*!< task waiting for an event (on event queue) */
 
 /**
@@ -27,12 +27,14 @@
  */
 struct tcb_entry {
 	uint16_t id;					/*!< task id */
+	uint8_t generation;				/*!< incremented each time the entry is taken by a new task, never 0 */
 	int8_t name[20];				/*!< task description (or name) */
 	uint8_t state;					/*!< 0 - idle,  1 - ready,  2 - running, 3 - blocked, 4 - delayed, 5 - waiting */
 	uint8_t priority;				/*!< [1 .. 29] - critical, [30 .. 99] - system, [100 .. 255] - application */
 	uint8_t priority_rem;				/*!< remaining priority */
+	uint8_t priority_base;				/*!< priority set by hf_priorityset(), without inherited priority */
 	uint8_t critical;				/*!< critical event, interrupt request */
-	uint32_t delay;					/*!< delay to enter in the run/RT queue */
+	uint32_t delay;					/*!< tick in which the task enters the run/RT queue (when delayed) */
 	uint32_t rtjobs;				/*!< total RT task jobs executed */
 	uint32_t bgjobs;				/*!< total BE task jobs executed */
 	uint32_t deadline_misses;			/*!< task realtime deadline misses */
@@ -47,6 +49,14 @@ struct tcb_entry {
 	size_t *pstack;					/*!< task stack area (bottom) */
 	uint32_t stack_size;				/*!< task stack size */
 	void *other_data;				/*!< pointer to other data related to this task */
+	struct tcb_entry *rq_next;			/*!< next task on the same priority level of the ready map */
+	struct tcb_entry *rq_prev;			/*!< previous task on the same priority level of the ready map */
+	uint32_t rt_release;				/*!< absolute tick of the next job release */
+	uint32_t rt_deadline;				/*!< absolute tick of the current job deadline */
+	uint32_t rt_next;				/*!< absolute tick of the next RT event (deadline or release) */
+	int16_t rt_rqpos;				/*!< position on the RT ready heap (-1 when not queued) */
+	int16_t rt_evpos;				/*!< position on the RT event heap (-1 when not queued) */
+	struct tcb_entry *delay_next;			/*!< next task on the same slot of the delay wheel */
 };
 
 struct pcb_entry {
@@ -70,7 +80,6 @@ uint16_t krnl_tasks;					/*!< number of tasks in the system */
 uint16_t krnl_current_task;				/*!< the current running task id */
 uint16_t krnl_schedule;					/*!< scheduler enable / disable flag */
 struct queue *krnl_run_queue;				/*!< pointer to a queue of best effort tasks */
-struct queue *krnl_delay_queue;				/*!< pointer to a queue of delayed tasks */
 struct queue *krnl_rt_queue;				/*!< pointer to a queue of real time tasks */
 struct queue *krnl_event_queue;				/*!< pointer to a queue of tasks waiting for an event */
 uint8_t krnl_heap[HEAP_SIZE];				/*!< contiguous heap memory area to be used as a memory pool. the memory allocator (malloc() and free()) controls this data structure */
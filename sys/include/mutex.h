@@ -18,6 +18,19 @@ struct mtx {
 typedef volatile struct mtx mutex_t;
 #endif
 
+#if MUTEX_TYPE == 2
+/**
+ * @brief Mutex data structure (blocking, with priority inheritance).
+ */
+struct mtx {
+	int32_t owner;					/*!< task id of the mutex owner, -1 when unlocked */
+	int32_t waiting;				/*!< number of tasks waiting on the mutex */
+	uint8_t wait[MAX_TASKS];			/*!< generation of the tasks waiting on the mutex, indexed by task id (0 if not waiting) */
+};
+
+typedef volatile struct mtx mutex_t;
+#endif
+
 void hf_mtxinit(mutex_t *m);
 void hf_mtxlock(mutex_t *m);
 void hf_mtxunlock(mutex_t *m);
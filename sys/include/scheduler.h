@@ -2,7 +2,18 @@ void dispatch_isr(void *arg);
 int32_t sched_rr(void);
 int32_t sched_lottery(void);
 int32_t sched_priorityrr(void);
+int32_t sched_bitmap(void);
 int32_t sched_rma(void);
 int32_t sched_dma(void);
 int32_t sched_edf(void);
 int32_t sched_llf(void);
+void sched_ready_add(struct tcb_entry *task);
+void sched_ready_rem(struct tcb_entry *task);
+void sched_handoff(struct tcb_entry *task);
+void sched_rt_add(struct tcb_entry *task);
+void sched_rt_rem(struct tcb_entry *task);
+void sched_delay_add(struct tcb_entry *task, uint32_t delay);
+#if TICKLESS == 1
+uint32_t sched_idle_ticks(void);
+void sched_idle_skip(uint32_t ticks);
+#endif
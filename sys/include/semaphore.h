@@ -12,3 +12,4 @@ int32_t hf_seminit(sem_t *s, int32_t value);
 int32_t hf_semdestroy(sem_t *s);
 void hf_semwait(sem_t *s);
 void hf_sempost(sem_t *s);
+void hf_sempostyield(sem_t *s);
@@ -48,10 +48,12 @@ static void clear_tcb(void)
 	for(i = 0; i < MAX_TASKS; i++){
 		krnl_task = &krnl_tcb[i];
 		krnl_task->id = -1;
+		krnl_task->generation = 0;
 		memset(krnl_task->name, 0, sizeof(krnl_task->name));
 		krnl_task->state = TASK_IDLE;
 		krnl_task->priority = 0;
 		krnl_task->priority_rem = 0;
+		krnl_task->priority_base = 0;
 		krnl_task->delay = 0;
 		krnl_task->rtjobs = 0;
 		krnl_task->bgjobs = 0;
@@ -66,6 +68,11 @@ static void clear_tcb(void)
 		krnl_task->pstack = NULL;
 		krnl_task->stack_size = 0;
 		krnl_task->other_data = 0;
+		krnl_task->rq_next = NULL;
+		krnl_task->rq_prev = NULL;
+		krnl_task->rt_rqpos = -1;
+		krnl_task->rt_evpos = -1;
+		krnl_task->delay_next = NULL;
 	}
 
 	krnl_tasks = 0;
@@ -89,8 +96,6 @@ static void init_queues(void)
 {
 	krnl_run_queue = hf_queue_create(MAX_TASKS);
 	if (krnl_run_queue == NULL) panic(PANIC_OOM);
-	krnl_delay_queue = hf_queue_create(MAX_TASKS);
-	if (krnl_delay_queue == NULL) panic(PANIC_OOM);
 	krnl_rt_queue = hf_queue_create(MAX_TASKS);
 	if (krnl_rt_queue == NULL) panic(PANIC_OOM);
 }
@@ -22,23 +22,346 @@
 #include <panic.h>
 #include <scheduler.h>
 
-static void process_delay_queue(void)
+/* ready map: one circular FIFO per priority level and a two level bitmap of non empty levels */
+static struct tcb_entry *ready_head[256];
+static uint32_t ready_map[8];
+static uint8_t ready_group;
+
+/* index of the least significant bit set on a byte */
+static const uint8_t ready_unmap[256] = {
+	0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+	4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+	5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+	4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+	6, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+	4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+	5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+	4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+	7, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+	4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+	5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+	4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+	6, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+	4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+	5, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
+	4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0
+};
+
+static uint8_t ready_ffs(uint32_t w)
 {
-	int32_t i, k;
-	struct tcb_entry *krnl_task2;
+	if (w & 0x000000ff)
+		return ready_unmap[w & 0xff];
+	if (w & 0x0000ff00)
+		return ready_unmap[(w >> 8) & 0xff] + 8;
+	if (w & 0x00ff0000)
+		return ready_unmap[(w >> 16) & 0xff] + 16;
+
+	return ready_unmap[w >> 24] + 24;
+}
 
-	k = hf_queue_count(krnl_delay_queue);
-	for (i = 0; i < k; i++){
-		krnl_task2 = hf_queue_remhead(krnl_delay_queue);
-		if (!krnl_task2) panic(PANIC_NO_TASKS_DELAY);
-		if (--krnl_task2->delay == 0){
-			if (krnl_task2->period){
-				if (hf_queue_addtail(krnl_rt_queue, krnl_task2)) panic(PANIC_CANT_PLACE_RT);
-			}else{
-				if (hf_queue_addtail(krnl_run_queue, krnl_task2)) panic(PANIC_CANT_PLACE_RUN);
-			}
+/* RT ready heap orderings */
+static int32_t rt_cmp_period(struct tcb_entry *e1, struct tcb_entry *e2)
+{
+	return (int32_t)e1->period - (int32_t)e2->period;
+}
+
+static int32_t rt_cmp_deadline(struct tcb_entry *e1, struct tcb_entry *e2)
+{
+	return (int32_t)e1->deadline - (int32_t)e2->deadline;
+}
+
+static int32_t rt_cmp_deadline_abs(struct tcb_entry *e1, struct tcb_entry *e2)
+{
+	return (int32_t)(e1->rt_deadline - e2->rt_deadline);
+}
+
+static int32_t rt_cmp_laxity(struct tcb_entry *e1, struct tcb_entry *e2)
+{
+	return ((int32_t)e1->deadline - (int32_t)e1->capacity_rem) - ((int32_t)e2->deadline - (int32_t)e2->capacity_rem);
+}
+
+/* RT heaps: ready jobs ordered by the policy of the RT scheduler, and RT tasks ordered by their next event */
+struct rt_heap {
+	int32_t elem;
+	struct tcb_entry *data[MAX_TASKS];
+};
+
+static struct rt_heap rt_ready, rt_event;
+static int32_t (*rt_cmp)(struct tcb_entry *e1, struct tcb_entry *e2) = rt_cmp_deadline_abs;
+static uint32_t rt_now;
+
+static int16_t *rt_heap_pos(struct rt_heap *h, struct tcb_entry *e)
+{
+	return (h == &rt_ready) ? &e->rt_rqpos : &e->rt_evpos;
+}
+
+static int32_t rt_heap_less(struct rt_heap *h, struct tcb_entry *e1, struct tcb_entry *e2)
+{
+	if (h == &rt_ready)
+		return rt_cmp(e1, e2) < 0;
+
+	return (int32_t)(e1->rt_next - e2->rt_next) < 0;
+}
+
+static void rt_heap_set(struct rt_heap *h, int32_t i, struct tcb_entry *e)
+{
+	h->data[i] = e;
+	*rt_heap_pos(h, e) = i;
+}
+
+static void rt_heap_up(struct rt_heap *h, int32_t i)
+{
+	struct tcb_entry *e = h->data[i];
+	int32_t parent;
+
+	while (i > 0){
+		parent = (i - 1) >> 1;
+		if (!rt_heap_less(h, e, h->data[parent]))
+			break;
+		rt_heap_set(h, i, h->data[parent]);
+		i = parent;
+	}
+	rt_heap_set(h, i, e);
+}
+
+static void rt_heap_down(struct rt_heap *h, int32_t i)
+{
+	struct tcb_entry *e = h->data[i];
+	int32_t child;
+
+	while ((child = (i << 1) + 1) < h->elem){
+		if (child + 1 < h->elem && rt_heap_less(h, h->data[child + 1], h->data[child]))
+			child++;
+		if (!rt_heap_less(h, h->data[child], e))
+			break;
+		rt_heap_set(h, i, h->data[child]);
+		i = child;
+	}
+	rt_heap_set(h, i, e);
+}
+
+static void rt_heap_insert(struct rt_heap *h, struct tcb_entry *e)
+{
+	if (h->elem == MAX_TASKS)
+		panic(PANIC_CANT_PLACE_RT);
+	rt_heap_set(h, h->elem++, e);
+	rt_heap_up(h, h->elem - 1);
+}
+
+static void rt_heap_remove(struct rt_heap *h, struct tcb_entry *e)
+{
+	int16_t *pos = rt_heap_pos(h, e);
+	int32_t i = *pos;
+
+	*pos = -1;
+	if (--h->elem == i)
+		return;
+	e = h->data[h->elem];
+	rt_heap_set(h, i, e);
+	rt_heap_up(h, i);
+	rt_heap_down(h, *rt_heap_pos(h, e));
+}
+
+/**
+ * @brief Puts a best effort task on the ready map.
+ *
+ * @param task is a pointer to a task control block entry.
+ *
+ * The task is linked at the tail of the FIFO of its priority level and the level is
+ * marked on the bitmap. Tasks already on the map are ignored, so this can be called on every
+ * transition to a runnable state. Realtime tasks are put on the RT ready heap instead, if they
+ * have capacity left on their current job. Must be called with interrupts disabled.
+ */
+void sched_ready_add(struct tcb_entry *task)
+{
+	struct tcb_entry *head;
+	uint8_t p;
+
+	if (task->period){
+		if (task->rt_evpos >= 0 && task->rt_rqpos < 0 && task->capacity_rem > 0 && task->state != TASK_BLOCKED)
+			rt_heap_insert(&rt_ready, task);
+		return;
+	}
+	if (task->rq_next)
+		return;
+
+	p = task->priority;
+	head = ready_head[p];
+	if (head){
+		task->rq_next = head;
+		task->rq_prev = head->rq_prev;
+		head->rq_prev->rq_next = task;
+		head->rq_prev = task;
+	}else{
+		task->rq_next = task;
+		task->rq_prev = task;
+		ready_head[p] = task;
+		ready_map[p >> 5] |= 1 << (p & 0x1f);
+		ready_group |= 1 << (p >> 5);
+	}
+}
+
+/**
+ * @brief Removes a best effort task from the ready map.
+ *
+ * @param task is a pointer to a task control block entry.
+ *
+ * The task is unlinked from the FIFO of its priority level, and the level is cleared on
+ * the bitmap if it becomes empty. Tasks which are not on the map are ignored. Realtime tasks
+ * are removed from the RT ready heap instead. Must be called with interrupts disabled.
+ */
+void sched_ready_rem(struct tcb_entry *task)
+{
+	uint8_t p;
+
+	if (task->period){
+		if (task->rt_rqpos >= 0)
+			rt_heap_remove(&rt_ready, task);
+		return;
+	}
+	if (!task->rq_next)
+		return;
+
+	p = task->priority;
+	if (task->rq_next == task){
+		ready_head[p] = NULL;
+		ready_map[p >> 5] &= ~(1 << (p & 0x1f));
+		if (!ready_map[p >> 5])
+			ready_group &= ~(1 << (p >> 5));
+	}else{
+		task->rq_prev->rq_next = task->rq_next;
+		task->rq_next->rq_prev = task->rq_prev;
+		if (ready_head[p] == task)
+			ready_head[p] = task->rq_next;
+	}
+	task->rq_next = NULL;
+	task->rq_prev = NULL;
+}
+
+static struct tcb_entry *ready_handoff;
+
+/**
+ * @brief Hands the processor over to a best effort task.
+ *
+ * @param task is a pointer to a task control block entry.
+ *
+ * The task is marked as critical and will be picked by the next best effort scheduling
+ * decision (sched_rr(), sched_lottery(), sched_priorityrr() or sched_bitmap()), bypassing
+ * the run queue or ready map order. A task which is blocked again before that is ignored.
+ * Realtime tasks are ignored, as they are scheduled by the RT scheduler. Must be called with
+ * interrupts disabled.
+ */
+void sched_handoff(struct tcb_entry *task)
+{
+	if (task->period)
+		return;
+	task->critical = 1;
+	ready_handoff = task;
+}
+
+/* pick the task the processor was handed over to, if it is still runnable */
+static int32_t handoff_next(void)
+{
+	struct tcb_entry *task = ready_handoff;
+
+	if (!task)
+		return 0;
+	ready_handoff = NULL;
+	if (!task->ptask || !task->critical || task->state == TASK_BLOCKED || task->state == TASK_DELAYED)
+		return 0;
+	task->critical = 0;
+	krnl_task = task;
+
+	return 1;
+}
+
+/* delay wheel: DELAY_WHEEL_LEVELS levels of DELAY_WHEEL_SLOTS slots, each slot a list of delayed tasks */
+#define DELAY_WHEEL_BITS	6
+#define DELAY_WHEEL_SLOTS	(1 << DELAY_WHEEL_BITS)
+#define DELAY_WHEEL_MASK	(DELAY_WHEEL_SLOTS - 1)
+#define DELAY_WHEEL_LEVELS	4
+#define DELAY_WHEEL_RANGE	(1 << (DELAY_WHEEL_BITS * DELAY_WHEEL_LEVELS))
+
+static struct tcb_entry *delay_wheel[DELAY_WHEEL_LEVELS][DELAY_WHEEL_SLOTS];
+static uint32_t delay_now;
+
+static void delay_wheel_insert(struct tcb_entry *task)
+{
+	uint32_t expires, diff;
+	int32_t level;
+
+	expires = task->delay;
+	diff = expires - delay_now;
+	if (diff >= DELAY_WHEEL_RANGE){
+		/* park on the last level, the task is inserted again when the slot is cascaded */
+		expires = delay_now + DELAY_WHEEL_RANGE - 1;
+		diff = DELAY_WHEEL_RANGE - 1;
+	}
+	for (level = 0; diff >= DELAY_WHEEL_SLOTS; level++)
+		diff >>= DELAY_WHEEL_BITS;
+	expires = (expires >> (level * DELAY_WHEEL_BITS)) & DELAY_WHEEL_MASK;
+	task->delay_next = delay_wheel[level][expires];
+	delay_wheel[level][expires] = task;
+}
+
+/**
+ * @brief Puts a task on the delay wheel.
+ *
+ * @param task is a pointer to a task control block entry.
+ * @param delay is the amount of time (in quantum / tick units).
+ *
+ * The absolute tick in which the delay expires is kept on the task and the task is
+ * linked on the wheel slot of that tick. Delays are counted by the dispatcher, so the
+ * task goes back to its run queue after delay ticks. Must be called with interrupts
+ * disabled.
+ */
+void sched_delay_add(struct tcb_entry *task, uint32_t delay)
+{
+	task->delay = delay_now + delay;
+	delay_wheel_insert(task);
+}
+
+/* cascade tasks from upper levels when the lower level wraps */
+static void delay_wheel_cascade(void)
+{
+	int32_t level;
+	uint32_t slot;
+	struct tcb_entry *krnl_task2, *next;
+
+	for (level = 1; level < DELAY_WHEEL_LEVELS; level++){
+		if ((delay_now >> ((level - 1) * DELAY_WHEEL_BITS)) & DELAY_WHEEL_MASK)
+			break;
+		slot = (delay_now >> (level * DELAY_WHEEL_BITS)) & DELAY_WHEEL_MASK;
+		krnl_task2 = delay_wheel[level][slot];
+		delay_wheel[level][slot] = NULL;
+		for (; krnl_task2; krnl_task2 = next){
+			next = krnl_task2->delay_next;
+			delay_wheel_insert(krnl_task2);
+		}
+	}
+}
+
+static void process_delay_queue(void)
+{
+	uint32_t slot;
+	struct tcb_entry *krnl_task2, *next;
+
+	delay_now++;
+	delay_wheel_cascade();
+
+	slot = delay_now & DELAY_WHEEL_MASK;
+	krnl_task2 = delay_wheel[0][slot];
+	delay_wheel[0][slot] = NULL;
+	for (; krnl_task2; krnl_task2 = next){
+		next = krnl_task2->delay_next;
+		krnl_task2->delay_next = NULL;
+		krnl_task2->delay = 0;
+		if (krnl_task2->period){
+			if (hf_queue_addtail(krnl_rt_queue, krnl_task2)) panic(PANIC_CANT_PLACE_RT);
+			sched_rt_add(krnl_task2);
 		}else{
-			if (hf_queue_addtail(krnl_delay_queue, krnl_task2)) panic(PANIC_CANT_PLACE_DELAY);
+			if (hf_queue_addtail(krnl_run_queue, krnl_task2)) panic(PANIC_CANT_PLACE_RUN);
+			sched_ready_add(krnl_task2);
 		}
 	}
 }
@@ -52,37 +375,105 @@ static void run_queue_next()
 		panic(PANIC_CANT_PLACE_RUN);
 }
 
-static void rt_queue_next()
+/**
+ * @brief Puts a realtime task on the set of tasks managed by the RT scheduler.
+ *
+ * @param task is a pointer to a task control block entry.
+ *
+ * Remaining period and deadline counters (relative values, kept while the task is out of the
+ * set) are converted to absolute ticks and the task is queued on the event heap. If the task
+ * has capacity left on its current job, it is also queued on the ready heap. Best effort tasks
+ * and tasks already on the set are ignored. Must be called with interrupts disabled.
+ */
+void sched_rt_add(struct tcb_entry *task)
 {
-	krnl_task = hf_queue_remhead(krnl_rt_queue);
-	if (!krnl_task)
-		panic(PANIC_NO_TASKS_RT);
-	if (hf_queue_addtail(krnl_rt_queue, krnl_task))
-		panic(PANIC_CANT_PLACE_RT);
+	if (!task->period || task->rt_evpos >= 0)
+		return;
+
+	task->rt_release = rt_now + task->period_rem;
+	task->rt_deadline = rt_now + task->deadline_rem;
+	task->rt_next = task->deadline_rem ? task->rt_deadline : task->rt_release;
+	rt_heap_insert(&rt_event, task);
+	sched_ready_add(task);
 }
 
-static uint16_t rt_schedule(int32_t k)
+/**
+ * @brief Removes a realtime task from the set of tasks managed by the RT scheduler.
+ *
+ * @param task is a pointer to a task control block entry.
+ *
+ * The task is removed from both RT heaps and its absolute release and deadline are converted
+ * back to remaining period and deadline counters, so time does not pass for the task while it is
+ * out of the set (e.g. delayed). Tasks which are not on the set are ignored. Must be called with
+ * interrupts disabled.
+ */
+void sched_rt_rem(struct tcb_entry *task)
+{
+	if (task->rt_evpos < 0)
+		return;
+
+	if (task->rt_rqpos >= 0)
+		rt_heap_remove(&rt_ready, task);
+	rt_heap_remove(&rt_event, task);
+	task->period_rem = task->rt_release - rt_now;
+	task->deadline_rem = ((int32_t)(task->rt_deadline - rt_now) > 0) ? task->rt_deadline - rt_now : 0;
+}
+
+/* process deadlines and job releases of the current tick */
+static void rt_process_events(void)
+{
+	struct tcb_entry *e;
+
+	while (rt_event.elem){
+		e = rt_event.data[0];
+		if ((int32_t)(e->rt_next - rt_now) > 0)
+			break;
+		if (e->rt_deadline == rt_now && e->capacity_rem > 0)
+			e->deadline_misses++;
+		if ((int32_t)(e->rt_release - rt_now) <= 0){
+			e->rt_release = rt_now + e->period;
+			e->rt_deadline = rt_now + e->deadline;
+			e->capacity_rem = e->capacity;
+			if (e->rt_rqpos >= 0)
+				rt_heap_remove(&rt_ready, e);
+			sched_ready_add(e);
+		}
+		e->rt_next = ((int32_t)(e->rt_deadline - rt_now) > 0) ? e->rt_deadline : e->rt_release;
+		rt_heap_down(&rt_event, 0);
+	}
+}
+
+static uint16_t rt_schedule(int32_t (*cmp)(struct tcb_entry *e1, struct tcb_entry *e2))
 {
 	int32_t i;
 	uint16_t id = 0;
 
-	for (i = 0; i < k; i++){
-		rt_queue_next();
-		if (krnl_task->state != TASK_BLOCKED && krnl_task->capacity_rem > 0 && !id){
-			id = krnl_task->id;
-			--krnl_task->capacity_rem;
-		}
+	if (rt_event.elem == 0)
+		return 0;
 
-		if (--krnl_task->deadline_rem == 0)
-			if (krnl_task->capacity_rem > 0) krnl_task->deadline_misses++;
+	/* the RT policy has changed, rebuild the ready heap */
+	if (rt_cmp != cmp){
+		rt_cmp = cmp;
+		for (i = (rt_ready.elem >> 1) - 1; i >= 0; i--)
+			rt_heap_down(&rt_ready, i);
+	}
 
-		if (--krnl_task->period_rem == 0){
-			krnl_task->period_rem = krnl_task->period;
-			krnl_task->capacity_rem = krnl_task->capacity;
-			krnl_task->deadline_rem = krnl_task->deadline;
+	while (rt_ready.elem){
+		krnl_task = rt_ready.data[0];
+		if (krnl_task->state != TASK_BLOCKED){
+			id = krnl_task->id;
+			if (--krnl_task->capacity_rem == 0)
+				rt_heap_remove(&rt_ready, krnl_task);
+			else
+				rt_heap_down(&rt_ready, 0);
+			break;
 		}
+		rt_heap_remove(&rt_ready, krnl_task);
 	}
 
+	rt_now++;
+	rt_process_events();
+
 	if (id){
 		krnl_task = &krnl_tcb[id];
 		krnl_task->rtjobs++;
@@ -94,22 +485,93 @@ static uint16_t rt_schedule(int32_t k)
 	}
 }
 
+#if TICKLESS == 1
+/**
+ * @brief Computes for how long the idle task may suppress the system tick.
+ *
+ * @return number of ticks until the next delay expiry or RT event, 0 if a task
+ * other than the idle task is ready to run or ~0 if there are no pending events.
+ *
+ * Must be called with interrupts disabled, from the idle task. The tick at the returned
+ * distance has to be handled by the dispatcher, all ticks before it may be skipped.
+ */
+uint32_t sched_idle_ticks(void)
+{
+	int32_t i;
+	uint32_t ticks = ~0, d;
+	struct tcb_entry *krnl_task2;
+
+	if (rt_ready.elem)
+		return 0;
+
+	for (i = 0; i < MAX_TASKS; i++){
+		krnl_task2 = &krnl_tcb[i];
+		if (!krnl_task2->ptask || i == krnl_current_task)
+			continue;
+		if (krnl_task2->state == TASK_DELAYED){
+			d = krnl_task2->delay - delay_now;
+			if (d < ticks)
+				ticks = d;
+		}else{
+			if (!krnl_task2->period && (krnl_task2->state == TASK_READY || krnl_task2->state == TASK_RUNNING))
+				return 0;
+		}
+	}
+	if (rt_event.elem){
+		d = rt_event.data[0]->rt_next - rt_now;
+		if (d < ticks)
+			ticks = d;
+	}
+
+	return ticks;
+}
+
+/**
+ * @brief Accounts for system ticks suppressed by the idle task.
+ *
+ * @param ticks is the number of ticks which have passed without a dispatch, and must be
+ * less than the value returned by sched_idle_ticks().
+ *
+ * The delay wheel and RT time are moved forward (only cascades happen, as no event is
+ * pending on skipped ticks) and the skipped ticks are accounted as jobs of the idle task.
+ * Must be called with interrupts disabled.
+ */
+void sched_idle_skip(uint32_t ticks)
+{
+	uint32_t step;
+
+	rt_now += ticks;
+	krnl_tcb[krnl_current_task].bgjobs += ticks;
+	while (ticks){
+		step = DELAY_WHEEL_SLOTS - (delay_now & DELAY_WHEEL_MASK);
+		if (step > ticks){
+			delay_now += ticks;
+			break;
+		}
+		delay_now += step;
+		ticks -= step;
+		delay_wheel_cascade();
+	}
+}
+#endif
 
 /**
  * @brief Task dispatcher.
  *
  * The job of the dispatcher is simple: save the current task context on the TCB,
  * update its state to ready and check its stack for overflow. If there are
- * tasks to be scheduled, process the delay queue and invoke the real-time scheduler callback.
+ * tasks to be scheduled, process the delay wheel and invoke the real-time scheduler callback.
  * If no RT tasks are ready to be scheduled, invoke the best effort scheduler callback.
  * Update the scheduled task state to running and restore the context of the task.
  *
- * Delayed tasks are in the delay queue, and are processed in the following way:
- *	- The number of elements (tasks) in queue is counted;
- *	- The a task from the head of the queue is removed and its delay is decremented;
- * 		- If the decremented delay of a task reaches 0, it is put on RT or BE run queue;
- * 		- It is put it back on the tail of the delay queue otherwise;
- *	- Repeat until the whole queue is processed;
+ * Delayed tasks are kept on a hierarchical timing wheel, and are processed in the following way:
+ *	- The wheel time is advanced by one tick;
+ *	- If the slot index of a level wraps, the current slot of the level above is emptied
+ * and its tasks are inserted again, moving closer to the lowest level;
+ *	- All tasks on the current slot of the lowest level have their delay expired, and
+ * are put on RT or BE run queue;
+ *	- Tasks on other slots are not touched, so the cost of a tick does not depend on the
+ * number of delayed tasks.
  */
 
 void dispatch_isr(void *arg)
@@ -159,14 +621,18 @@ void dispatch_isr(void *arg)
  *	  blocked, at least it is what we hope!).
  * 	- Tasks in the blocked state are never removed from the run queue (they are
  *	  ignored), although they may be in another queue waiting for a resource.
+ * 	- A task the processor was handed over to (sched_handoff()) is picked first.
  */
 int32_t sched_rr(void)
 {
 	if (hf_queue_count(krnl_run_queue) == 0)
 		panic(PANIC_NO_TASKS_RUN);
+	if (handoff_next())
+		goto done;
 	do {
 		run_queue_next();
 	} while (krnl_task->state == TASK_BLOCKED);
+done:
 	krnl_task->bgjobs++;
 
 	return krnl_task->id;
@@ -181,17 +647,21 @@ int32_t sched_rr(void)
  * 	- Take a task from the run queue, copy its entry and put it back at the tail of the run queue.
  * 	- If the task is in the blocked state (it may be simply blocked or waiting in a semaphore) or
  * its not the ticket, it is put back at the tail of the run queue and the next task is picked up.
+ * 	- A task the processor was handed over to (sched_handoff()) is picked first, without a draw.
  */
 int32_t sched_lottery(void)
 {
 	int32_t r, i = 0;
 
-	r = random() % krnl_tasks;
 	if (hf_queue_count(krnl_run_queue) == 0)
 		panic(PANIC_NO_TASKS_RUN);
+	if (handoff_next())
+		goto done;
+	r = random() % krnl_tasks;
 	do {
 		run_queue_next();
 	} while ((krnl_task->state == TASK_BLOCKED) || ((i++ % krnl_tasks) != r));
+done:
 	krnl_task->bgjobs++;
 
 	return krnl_task->id;
@@ -203,6 +673,7 @@ int32_t sched_lottery(void)
  * @return Best effort task id.
  *
  * The algorithm is priority based Round Robin.
+ * 	- If the processor was handed over to a task (sched_handoff()), schedule it and get out.
  * 	- Take the first task and put it at the end of the run queue (to advance the queue and avoid deadlocks)
  * 	- Perform a run in the queue, searching for the task with the highest priority (non blocked, lowest remaining priority)
  * 		- While we are at it, check if there is a critical task. If so, schedule it, and get out.
@@ -219,6 +690,8 @@ int32_t sched_priorityrr(void)
 	k = hf_queue_count(krnl_run_queue);
 	if (k == 0)
 		panic(PANIC_NO_TASKS_RUN);
+	if (handoff_next())
+		goto done;
 
 	/* advance the queue to prevent deadlocks */
 	run_queue_next();
@@ -252,40 +725,62 @@ done:
 	return krnl_task->id;
 }
 
+/**
+ * @brief Best effort (BE) scheduler (callback).
+ *
+ * @return Best effort task id.
+ *
+ * The algorithm is fixed priority with Round Robin among tasks of the same priority, in constant time.
+ * 	- Runnable best effort tasks are kept on the ready map, a FIFO per priority level and a bitmap of
+ * 	  non empty levels. Tasks leave the map when blocked, delayed or killed and get back when resumed.
+ * 	- Find the highest priority (lowest value) non empty level on the bitmap, take the task at the head
+ * 	  of its FIFO and rotate the FIFO, so tasks of the same priority share the processor.
+ * 	- A blocked task found on the map (its state was changed without the map being updated) is removed
+ * 	  and the search is repeated.
+ * 	- Tasks on lower priority levels only run when all higher levels are empty (or blocked). The idle
+ * 	  task is never blocked, so it should be moved to the lowest level in use (e.g. hf_priorityset(0, 255)).
+ * 	- A task the processor was handed over to (sched_handoff()) is picked first. Other uses of the
+ * 	  critical flag are not honored by this scheduler.
+ */
+int32_t sched_bitmap(void)
+{
+	uint8_t g, p;
+
+	if (handoff_next())
+		goto done;
+	do {
+		if (!ready_group)
+			panic(PANIC_NO_TASKS_RUN);
+		g = ready_unmap[ready_group];
+		p = (g << 5) + ready_ffs(ready_map[g]);
+		krnl_task = ready_head[p];
+		ready_head[p] = krnl_task->rq_next;
+		if (krnl_task->state == TASK_BLOCKED)
+			sched_ready_rem(krnl_task);
+	} while (krnl_task->state == TASK_BLOCKED);
+done:
+	krnl_task->bgjobs++;
+
+	return krnl_task->id;
+}
+
 /**
  * @brief Real time (RT) scheduler (callback).
  *
  * @return Real time task id.
  *
  * The scheduling algorithm is Rate Monotonic.
- * 	- Sort the queue of RT tasks by period;
- * 	- Update real time information (remaining deadline and capacity) of the
- * whole task set.
- * 	- If the task at the head of the queue fits the requirements to be scheduled
- * (not blocked, has jobs to execute and no task with higher priority according to RM
- * was selected) then register the task to be scheduled.
+ * 	- Ready RT jobs (not blocked and with capacity left on the current period) are kept on a binary
+ * heap ordered by period, so the task at the top has the highest priority according to RM;
+ * 	- The task at the top of the heap is scheduled and its capacity is consumed. The task leaves the
+ * heap when its job is completed;
+ * 	- Job releases and deadlines are kept on a second heap ordered by time, so only tasks which have
+ * an event on the current tick are updated.
  */
 
 int32_t sched_rma(void)
 {
-	int32_t i, j, k;
-	struct tcb_entry *e1, *e2;
-
-	k = hf_queue_count(krnl_rt_queue);
-	if (k == 0)
-		return 0;
-
-	for (i = 0; i < k-1; i++){
-		for (j = i + 1; j < k; j++){
-			e1 = hf_queue_get(krnl_rt_queue, i);
-			e2 = hf_queue_get(krnl_rt_queue, j);
-			if (e1->period > e2->period)
-				if (hf_queue_swap(krnl_rt_queue, i, j))
-					panic(PANIC_CANT_SWAP);
-		}
-	}
-
-	return rt_schedule(k);
+	return rt_schedule(rt_cmp_period);
 }
 
 /**
@@ -294,34 +789,15 @@ int32_t sched_rma(void)
  * @return Real time task id.
  *
  * The scheduling algorithm is Deadline Monotonic.
- * 	- Sort the queue of RT tasks by deadline;
- * 	- Update real time information (remaining deadline and capacity) of the
- * whole task set.
- * 	- If the task at the head of the queue fits the requirements to be scheduled
- * (not blocked, has jobs to execute and no task with higher priority according to RM
- * was selected) then register the task to be scheduled.
+ * 	- Ready RT jobs are kept on a binary heap ordered by (relative) deadline;
+ * 	- The task at the top of the heap is scheduled and its capacity is consumed. The task leaves the
+ * heap when its job is completed;
+ * 	- Job releases and deadlines are processed as events, as in the RM scheduler.
  */
 
 int32_t sched_dma(void)
 {
-	int32_t i, j, k;
-	struct tcb_entry *e1, *e2;
-
-	k = hf_queue_count(krnl_rt_queue);
-	if (k == 0)
-		return 0;
-
-	for (i = 0; i < k-1; i++){
-		for (j = i + 1; j < k; j++){
-			e1 = hf_queue_get(krnl_rt_queue, i);
-			e2 = hf_queue_get(krnl_rt_queue, j);
-			if (e1->deadline > e2->deadline)
-				if (hf_queue_swap(krnl_rt_queue, i, j))
-					panic(PANIC_CANT_SWAP);
-		}
-	}
-
-	return rt_schedule(k);
+	return rt_schedule(rt_cmp_deadline);
 }
 
 
@@ -331,34 +807,16 @@ int32_t sched_dma(void)
  * @return Real time task id.
  *
  * The scheduling algorithm is Earliest Deadline First.
- * 	- Sort the queue of RT tasks by remaining deadline;
- * 	- Update real time information (remaining deadline and capacity) of the
- * whole task set.
- * 	- If the task at the head of the queue fits the requirements to be scheduled
- * (not blocked, has jobs to execute and no task with higher priority according to EDF
- * was selected) then register the task to be scheduled.
+ * 	- Ready RT jobs are kept on a binary heap ordered by absolute deadline, which is only
+ * updated when a new job of the task is released;
+ * 	- The task at the top of the heap is scheduled and its capacity is consumed. The task leaves the
+ * heap when its job is completed;
+ * 	- Job releases and deadlines are processed as events, as in the RM scheduler.
  */
 
 int32_t sched_edf(void)
 {
-	int32_t i, j, k;
-	struct tcb_entry *e1, *e2;
-
-	k = hf_queue_count(krnl_rt_queue);
-	if (k == 0)
-		return 0;
-
-	for (i = 0; i < k-1; i++){
-		for (j = i + 1; j < k; j++){
-			e1 = hf_queue_get(krnl_rt_queue, i);
-			e2 = hf_queue_get(krnl_rt_queue, j);
-			if (e1->deadline_rem > e2->deadline_rem)
-				if (hf_queue_swap(krnl_rt_queue, i, j))
-					panic(PANIC_CANT_SWAP);
-		}
-	}
-
-	return rt_schedule(k);
+	return rt_schedule(rt_cmp_deadline_abs);
 }
 
 /**
@@ -367,29 +825,12 @@ int32_t sched_edf(void)
  * @return Real time task id.
  *
  * The scheduling algorithm is Least Laxity First (Least Slack Time)
+ * 	- Ready RT jobs are kept on a binary heap ordered by laxity (deadline - remaining capacity).
+ * Only the laxity of the scheduled task changes on a tick, so it is sifted down the heap after
+ * its capacity is consumed.
  */
 
 int32_t sched_llf(void)
 {
-	int32_t i, j, k;
-	int32_t sl1, sl2;
-	struct tcb_entry *e1, *e2;
-
-	k = hf_queue_count(krnl_rt_queue);
-	if (k == 0)
-		return 0;
-
-	for (i = 0; i < k-1; i++){
-		for (j = i + 1; j < k; j++){
-			e1 = hf_queue_get(krnl_rt_queue, i);
-			e2 = hf_queue_get(krnl_rt_queue, j);
-			sl1 = e1->deadline - e1->capacity_rem;
-			sl2 = e2->deadline - e2->capacity_rem;
-			if (sl1 > sl2)
-				if (hf_queue_swap(krnl_rt_queue, i, j))
-					panic(PANIC_CANT_SWAP);
-		}
-	}
-
-	return rt_schedule(k);
+	return rt_schedule(rt_cmp_laxity);
 }
@@ -156,9 +156,13 @@ int32_t hf_dlm(uint16_t id){
  * @param priority is the task priority ([1 .. 29] - critical, [30 .. 99] - system, [100 .. 255] - application)
  * 
  * @return ERR_OK if the task exists and is a best effort one or ERR_INVALID_ID otherwise.
+ *
+ * The priority is also kept as the base priority of the task, which a mutex owner goes back to
+ * when it drops a priority inherited from a waiting task.
  */
 int32_t hf_priorityset(uint16_t id, uint8_t priority)
 {
+	volatile uint32_t status;
 	struct tcb_entry *krnl_task2;
 	
 #if KERNEL_LOG == 2
@@ -168,8 +172,17 @@ int32_t hf_priorityset(uint16_t id, uint8_t priority)
 		krnl_task2 = &krnl_tcb[id];
 		if (krnl_task2->ptask){
 			if (krnl_task2->period == 0){
-				krnl_task2->priority = priority;
+				status = _di();
+				if (krnl_task2->rq_next){
+					sched_ready_rem(krnl_task2);
+					krnl_task2->priority = priority;
+					sched_ready_add(krnl_task2);
+				}else{
+					krnl_task2->priority = priority;
+				}
 				krnl_task2->priority_rem = priority;
+				krnl_task2->priority_base = priority;
+				_ei(status);
 				
 				return ERR_OK;
 			}
@@ -243,10 +256,13 @@ int32_t hf_spawn(void (*task)(), uint16_t period, uint16_t capacity, uint16_t de
 	krnl_tasks++;
 	krnl_task = &krnl_tcb[i];
 	krnl_task->id = i;
+	if (++krnl_task->generation == 0)
+		krnl_task->generation = 1;
 	strncpy(krnl_task->name, name, sizeof(krnl_task->name));
 	krnl_task->state = TASK_IDLE;
 	krnl_task->priority = 100;
 	krnl_task->priority_rem = 100;
+	krnl_task->priority_base = 100;
 	krnl_task->delay = 0;
 	krnl_task->period = period;
 	krnl_task->capacity = capacity;
@@ -258,6 +274,11 @@ int32_t hf_spawn(void (*task)(), uint16_t period, uint16_t capacity, uint16_t de
 	krnl_task->bgjobs = 0;
 	krnl_task->deadline_misses = 0;
 	krnl_task->ptask = task;
+	krnl_task->rq_next = NULL;
+	krnl_task->rq_prev = NULL;
+	krnl_task->rt_rqpos = -1;
+	krnl_task->rt_evpos = -1;
+	krnl_task->delay_next = NULL;
 	stack_size += 3;
 	stack_size >>= 2;
 	stack_size <<= 2;
@@ -270,8 +291,10 @@ int32_t hf_spawn(void (*task)(), uint16_t period, uint16_t capacity, uint16_t de
 		kprintf("\nKERNEL: [%s], id: %d, p:%d, c:%d, d:%d, addr: %x, sp: %x, ss: %d bytes", krnl_task->name, krnl_task->id, krnl_task->period, krnl_task->capacity, krnl_task->deadline, krnl_task->ptask, _get_task_sp(krnl_task->id), stack_size);
 		if (period){
 			if (hf_queue_addtail(krnl_rt_queue, krnl_task)) panic(PANIC_CANT_PLACE_RT);
+			sched_rt_add(krnl_task);
 		}else{
 			if (hf_queue_addtail(krnl_run_queue, krnl_task)) panic(PANIC_CANT_PLACE_RUN);
+			sched_ready_add(krnl_task);
 		}
 	}else{
 		krnl_task->ptask = 0;
@@ -361,6 +384,7 @@ int32_t hf_block(uint16_t id)
 		return ERR_ERROR;
 	}
 	krnl_task->state = TASK_BLOCKED;
+	sched_ready_rem(krnl_task);
 	krnl_task = &krnl_tcb[krnl_current_task];
 	_ei(status);
 	
@@ -406,6 +430,7 @@ int32_t hf_resume(uint16_t id)
 		return ERR_ERROR;
 	}
 	krnl_task->state = TASK_READY;
+	sched_ready_add(krnl_task);
 	krnl_task = &krnl_tcb[krnl_current_task];
 	_ei(status);
 
@@ -452,6 +477,8 @@ int32_t hf_kill(uint16_t id)
 	_set_task_tp(krnl_task->id, 0);
 	krnl_task->state = TASK_IDLE;
 	krnl_tasks--;
+	sched_ready_rem(krnl_task);
+	sched_rt_rem(krnl_task);
 
 	if (krnl_task->period){
 		k = hf_queue_count(krnl_rt_queue);
@@ -492,9 +519,9 @@ int32_t hf_kill(uint16_t id)
  * 
  * @return ERR_OK on success or ERR_INVALID_ID if the referenced task does not exist.
  * 
- * A task is removed from its run queue and its state is marked as TASK_DELAYED. The task is put on the delay queue
+ * A task is removed from its run queue and its state is marked as TASK_DELAYED. The task is put on the delay wheel
  * and remains there until the dispatcher places it back to its run queue. Time is managed by the task dispatcher, which
- * counts down delays, controls the delay queue by cycling the tasks and removing them when the task delay has passed.
+ * advances the wheel on every tick and only touches the tasks whose delay has passed.
  */
 int32_t hf_delay(uint16_t id, uint32_t delay)
 {
@@ -538,9 +565,12 @@ int32_t hf_delay(uint16_t id, uint32_t delay)
 		krnl_task2 = hf_queue_remhead(krnl_run_queue);
 	}
 	
+	if (!krnl_task2 || krnl_task2 != krnl_task) panic(PANIC_UNKNOWN_TASK_STATE);
+
 	krnl_task->state = TASK_DELAYED;
-	krnl_task->delay = delay;
-	if (hf_queue_addtail(krnl_delay_queue, krnl_task2)) panic(PANIC_CANT_PLACE_DELAY);
+	sched_ready_rem(krnl_task);
+	sched_rt_rem(krnl_task);
+	sched_delay_add(krnl_task, delay);
 	krnl_task = &krnl_tcb[krnl_current_task];
 	_ei(status);
 	
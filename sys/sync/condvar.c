@@ -21,6 +21,7 @@
 #include <condvar.h>
 #include <kernel.h>
 #include <panic.h>
+#include <scheduler.h>
 #include <task.h>
 #include <ecodes.h>
 
@@ -90,6 +91,7 @@ void hf_condwait(cond_t *c, mutex_t *m)
 		panic(PANIC_NUTS_SEM);
 	else
 		krnl_task2->state = TASK_BLOCKED;
+	sched_ready_rem(krnl_task2);
 	hf_mtxunlock(m);
 	_ei(status);
 	hf_yield();
@@ -112,8 +114,10 @@ void hf_condsignal(cond_t *c)
 
 	status = _di();
 	krnl_task2 = hf_queue_remhead(c->cond_queue);
-	if (krnl_task2)
+	if (krnl_task2){
 		krnl_task2->state = TASK_READY;
+		sched_ready_add(krnl_task2);
+	}
 	_ei(status);
 }
 
@@ -134,8 +138,10 @@ void hf_condbroadcast(cond_t *c)
 	status = _di();
 	while (hf_queue_count(c->cond_queue)){
 		krnl_task2 = hf_queue_remhead(c->cond_queue);
-		if (krnl_task2)
+		if (krnl_task2){
 			krnl_task2->state = TASK_READY;
+			sched_ready_add(krnl_task2);
+		}
 	}
 	_ei(status);
 }
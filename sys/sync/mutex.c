@@ -18,6 +18,11 @@
 #include <libc.h>
 #include <mutex.h>
 #include <ecodes.h>
+#if MUTEX_TYPE == 2
+#include <kernel.h>
+#include <scheduler.h>
+#include <task.h>
+#endif
 
 #if MUTEX_TYPE == 0
 /* type 0: spinlock
@@ -103,3 +108,169 @@ void hf_mtxunlock(mutex_t *m)
 }
 #endif
 
+
+#if MUTEX_TYPE == 2
+/* type 2: blocking mutex with priority inheritance
+ */
+
+/*
+ * priority a best effort owner inherits from a waiting task. RT tasks are considered as important as
+ * the most important best effort task, so the owner shares the processor with it instead of starving
+ * every best effort task
+ */
+static uint8_t mtx_priority(struct tcb_entry *task)
+{
+	int32_t i;
+	uint8_t p = 255;
+
+	if (!task->period)
+		return task->priority;
+
+	for (i = 0; i < MAX_TASKS; i++)
+		if (krnl_tcb[i].ptask && !krnl_tcb[i].period && krnl_tcb[i].priority < p)
+			p = krnl_tcb[i].priority;
+
+	return p;
+}
+
+/* sets the priority of a best effort task, keeping its base priority. called with interrupts disabled */
+static void mtx_inherit(struct tcb_entry *task, uint8_t priority)
+{
+	if (task->rq_next){
+		sched_ready_rem(task);
+		task->priority = priority;
+		sched_ready_add(task);
+	}else{
+		task->priority = priority;
+	}
+	task->priority_rem = priority;
+}
+
+/**
+ * @brief Initializes a mutex, defining its initial value.
+ * 
+ * @param m is a pointer to a mutex.
+ */
+void hf_mtxinit(mutex_t *m)
+{
+	int32_t i;
+
+	m->owner = -1;
+	m->waiting = 0;
+	for (i = 0; i < MAX_TASKS; i++)
+		m->wait[i] = 0;
+}
+
+/**
+ * @brief Locks a mutex.
+ * 
+ * @param m is a pointer to a mutex.
+ * 
+ * If the mutex is not locked, the calling task becomes its owner and continues execution.
+ * Otherwise, the task is blocked and parked on the mutex until the owner hands the mutex
+ * over. If the waiting task is more important than a best effort owner, the owner inherits
+ * the priority of the waiting task until it unlocks the mutex (an RT waiting task lends the
+ * priority of the most important best effort task). Priorities are not inherited across chains
+ * of mutexes and RT owners are not boosted.
+ */
+void hf_mtxlock(mutex_t *m)
+{
+	volatile uint32_t status;
+	struct tcb_entry *krnl_task2, *owner;
+	uint8_t p;
+
+	status = _di();
+	if (m->owner < 0){
+		m->owner = krnl_current_task;
+		_ei(status);
+		return;
+	}
+
+	krnl_task2 = &krnl_tcb[krnl_current_task];
+	owner = &krnl_tcb[m->owner];
+	p = mtx_priority(krnl_task2);
+	if (!owner->period && p < owner->priority)
+		mtx_inherit(owner, p);
+
+	/* a slot left by a killed waiting task is already counted */
+	if (!m->wait[krnl_current_task])
+		m->waiting++;
+	m->wait[krnl_current_task] = krnl_task2->generation;
+	krnl_task2->state = TASK_BLOCKED;
+	sched_ready_rem(krnl_task2);
+	_ei(status);
+	hf_yield();
+}
+
+/**
+ * @brief Unlocks a mutex.
+ * 
+ * @param m is a pointer to a mutex.
+ * 
+ * The owner drops any inherited priority, going back to its base priority (the last one set
+ * with hf_priorityset()). If there are tasks waiting, the ownership is handed over directly
+ * to the most important waiting task (RT tasks first, then best effort tasks by priority),
+ * which is unblocked. The new owner inherits the priority of the remaining waiting tasks,
+ * if needed. Waiting tasks are recorded with the generation of their TCB entry, so a task
+ * killed while waiting is skipped even if its entry was taken by a new task.
+ */
+void hf_mtxunlock(mutex_t *m)
+{
+	volatile uint32_t status;
+	struct tcb_entry *krnl_task2;
+	int32_t i, next = -1;
+	uint8_t p, best = 255, second = 255;
+
+	status = _di();
+	if (m->owner < 0){
+		_ei(status);
+		return;
+	}
+
+	krnl_task2 = &krnl_tcb[m->owner];
+	if (!krnl_task2->period && krnl_task2->priority != krnl_task2->priority_base)
+		mtx_inherit(krnl_task2, krnl_task2->priority_base);
+
+	if (m->waiting == 0){
+		m->owner = -1;
+		_ei(status);
+		return;
+	}
+
+	for (i = 0; i < MAX_TASKS; i++){
+		if (!m->wait[i])
+			continue;
+		/* the waiting task was killed (the entry may have been taken by a new task) */
+		if (!krnl_tcb[i].ptask || krnl_tcb[i].generation != m->wait[i]){
+			m->wait[i] = 0;
+			m->waiting--;
+			continue;
+		}
+		p = mtx_priority(&krnl_tcb[i]);
+		if (next < 0 || p < best){
+			second = best;
+			best = p;
+			next = i;
+		}else{
+			if (p < second)
+				second = p;
+		}
+	}
+
+	if (next < 0){
+		m->owner = -1;
+		_ei(status);
+		return;
+	}
+
+	m->wait[next] = 0;
+	m->waiting--;
+	m->owner = next;
+	krnl_task2 = &krnl_tcb[next];
+	if (m->waiting && !krnl_task2->period && second < krnl_task2->priority)
+		mtx_inherit(krnl_task2, second);
+	krnl_task2->state = TASK_READY;
+	sched_ready_add(krnl_task2);
+	_ei(status);
+}
+#endif
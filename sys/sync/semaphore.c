@@ -20,6 +20,7 @@
 #include <semaphore.h>
 #include <kernel.h>
 #include <panic.h>
+#include <scheduler.h>
 #include <task.h>
 #include <ecodes.h>
 
@@ -91,6 +92,7 @@ void hf_semwait(sem_t *s)
 			panic(PANIC_NUTS_SEM);
 		else
 			krnl_task2->state = TASK_BLOCKED;
+		sched_ready_rem(krnl_task2);
 		_ei(status);
 		hf_yield();
 	}else{
@@ -120,6 +122,34 @@ void hf_sempost(sem_t *s)
 			panic(PANIC_NUTS_SEM);
 		else
 			krnl_task2->state = TASK_READY;
+		sched_ready_add(krnl_task2);
 	}
 	_ei(status);
 }
+
+/**
+ * @brief Signal a semaphore, handing the processor over to the woken task.
+ * 
+ * @param s is a pointer to a semaphore.
+ * 
+ * Same as hf_sempost(), but if a best effort task is unblocked the processor is handed
+ * over to it and the calling task yields, so the woken task runs next instead of waiting
+ * for its turn on the run queue. This lowers the wakeup latency of producer / consumer
+ * patterns. Must not be called from interrupt context.
+ */
+void hf_sempostyield(sem_t *s)
+{
+	volatile uint32_t status;
+	struct tcb_entry *krnl_task2;
+
+	status = _di();
+	krnl_task2 = s->count < 0 ? hf_queue_get(s->sem_queue, 0) : NULL;
+	hf_sempost(s);
+	if (krnl_task2 && !krnl_task2->period){
+		sched_handoff(krnl_task2);
+		_ei(status);
+		hf_yield();
+	}else{
+		_ei(status);
+	}
+}
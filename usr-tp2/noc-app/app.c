@@ -36,6 +36,7 @@ void source(void)
     int8_t buf[SIZE_COMM_BUFFER];
     int16_t val;
     int32_t shift;
+    struct noc_iovec iov[2];
 
     printf("cpu %d, name %s, thread %d.\n", hf_cpuid(), hf_selfname(), hf_selfid());
 
@@ -77,8 +78,12 @@ void source(void)
         ptr = image + shift;
         crc = hf_crc32((int8_t *)ptr, sizeof(buf) - SIZE_CRC);
 //        crc = hf_crc32((int8_t *)ptr[cpu - 1], sizeof(buf) - SIZE_CRC);
-        memcpy(ptr + WIDTH_IMAGE, &crc, SIZE_CRC);
-        val = hf_send(cpu, port, (int8_t *) ptr, SIZE_COMM_BUFFER, 1);
+        // the line and its crc are packed straight from the image and crc, no staging copy
+        iov[0].base = (int8_t *) ptr;
+        iov[0].len = WIDTH_IMAGE;
+        iov[1].base = (int8_t *) &crc;
+        iov[1].len = SIZE_CRC;
+        val = hf_sendv(cpu, port, iov, 2, 1);
 
         if (val){
             printf("hf_send(): error %d\n", val);
@@ -102,9 +107,10 @@ void worker(void)
     uint16_t cpu, port, size, cpuid, shift_source, shift_target;
     uint32_t crc, recv_messages=0, i;
 
-    int8_t buffer_source[SIZE_COMM_BUFFER], buf_dummy[1], buffer_target[SIZE_COMM_BUFFER];
+    int8_t buffer_source[SIZE_COMM_BUFFER], buf_dummy[1];
     int16_t val;
     int32_t channel;
+    struct noc_iovec iov[2];
 
     cpuid = hf_cpuid();
     shift_source = MESSAGE_PER_CPU * (cpuid - 1);
@@ -190,13 +196,15 @@ void worker(void)
         printf("process ");
 
 
-        memmove(buffer_target, img_sobel + CENTER_LINE * WIDTH_IMAGE, WIDTH_IMAGE);
-        crc = hf_crc32((int8_t *)buffer_target, sizeof(buffer_target) - SIZE_CRC);
-        memcpy(buffer_target + WIDTH_IMAGE, &crc, SIZE_CRC);
+        crc = hf_crc32((int8_t *)(img_sobel + CENTER_LINE * WIDTH_IMAGE), WIDTH_IMAGE);
+        iov[0].base = (int8_t *)(img_sobel + CENTER_LINE * WIDTH_IMAGE);
+        iov[0].len = WIDTH_IMAGE;
+        iov[1].base = (int8_t *) &crc;
+        iov[1].len = SIZE_CRC;
         printf("copy ");
 
         // send data to target
-        val = hf_send(CPU_TARGET, PORT_TARGET, buffer_target,SIZE_COMM_BUFFER, shift_target);
+        val = hf_sendv(CPU_TARGET, PORT_TARGET, iov, 2, shift_target);
         if (val)
             printf("hf_send(): error %d\n", val);
         printf("%s send ", hf_selfname());
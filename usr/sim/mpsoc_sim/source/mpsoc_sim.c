@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
 #include "noc.h"
 
 /*
@@ -32,6 +34,16 @@
 #define OUT_FACILITY			0x200000D0	/* not implemented yet */
 #define LOG_FACILITY			0x200000E0
 #define EXIT_TRAP			0x200000F0
+#define SLEEP_REG			0x20000100	/* halt the core until the counter reaches the written value or a NoC irq is pending */
+#define NOC_DMA_CTRL			0x20000110	/* bit 0: DMA enable (writing resets the ring indexes) */
+#define NOC_DMA_TX_RING			0x20000120	/* address of the TX descriptor ring */
+#define NOC_DMA_RX_RING			0x20000130	/* address of the RX descriptor ring */
+#define NOC_DMA_RING_SIZE		0x20000140	/* number of descriptors of each ring */
+#define NOC_DMA_STATUS			0x20000150	/* bit 0: RX completion, bit 1: TX completion. cleared (and the irq acknowledged) on read */
+
+#define DMA_DESC_OWN			0x80000000	/* descriptor owned by the NI */
+#define DMA_STATUS_RX			0x01
+#define DMA_STATUS_TX			0x02
 
 #define IRQ_UART_READ_AVAILABLE		0x01
 #define IRQ_UART_WRITE_AVAILABLE	0x02
@@ -54,6 +66,23 @@
 
 #define UART_DELAY ((reference_clock / 57600) * 10)	// uart delay @ 57600bps (cycles)
 
+#ifndef DECODE_CACHE_SIZE
+#define DECODE_CACHE_SIZE		8192		// decoded instructions kept per core (power of 2)
+#endif
+#define DECODE_INVALID			0xffffffff	// tag of an empty entry (never word aligned)
+
+#ifndef BLOCK_TABLE_SIZE
+#define BLOCK_TABLE_SIZE		256		// translated blocks kept per core (power of 2)
+#endif
+#ifndef BLOCK_THRESHOLD
+#define BLOCK_THRESHOLD			16		// executions of an entry point before its block is translated
+#endif
+#define BLOCK_MAX			32		// instructions per block
+#define BLOCK_PAGE_SHIFT		8		// granularity of the code pages which hold blocks (256 bytes)
+
+#define SPIN_POLL			0x01		// a core read a register which reading does not change
+#define SPIN_OTHER			0x02		// a core stored, accessed another register or took an interrupt
+
 #define ntohs(A) ( ((A)>>8) | (((A)&0xff)<<8) )
 #define htons(A) ntohs(A)
 #define ntohl(A) ( ((A)>>24) | (((A)&0xff0000)>>8) | (((A)&0xff00)<<8) | ((A)<<24) )
@@ -79,6 +108,42 @@ typedef struct {
 	char no_execute_branch_delay_slot;
 } State;
 
+/* an instruction fetched and decoded once, tagged by its offset in the core memory */
+typedef struct {
+	unsigned int tag;
+	unsigned int opcode;
+	unsigned int target;
+	int imm_shift;
+	unsigned short imm;
+	unsigned char op, rs, rt, rd, re, func;
+} Decoded;
+
+/* a translated block: straight line code from an entry point up to a branch and its delay slot */
+typedef struct {
+	unsigned int tag;
+	int count;			// executions of the entry point while profiling, or refreshed when run
+	int len;			// number of instructions, -1 while profiling
+	Decoded insn[BLOCK_MAX];
+} Block;
+
+/* a core polling a register: its state right after the last polling read, and what an iteration of the loop adds */
+typedef struct {
+	State state;
+	unsigned long long cycle;	// cycle of the last polling read
+	unsigned int address;		// register polled, and the value read
+	unsigned int value;
+	int pause;
+	int valid;			// the state was taken and nothing but polling happened since
+	long long period;		// cycles of an iteration of a confirmed spin (0: not spinning)
+	unsigned int ops[0x40];		// instruction counters at the last polling read, and the increment of an iteration
+	unsigned int ops_delta[0x40];
+	double energy;
+	double energy_delta;
+	unsigned int poll_address;	// polling read of the instruction (or block) being run
+	unsigned int poll_value;
+	unsigned char io;		// SPIN_POLL, SPIN_OTHER
+} Spin;
+
 // implemented MIPS opcodes
 static char *opcode_string[]={
 	"SPECIAL","REGIMM","J","JAL","BEQ","BNE","BLEZ","BGTZ",
@@ -143,6 +208,8 @@ static char *class_shift[]={
 unsigned char is_sending[MAX_N_CORES]; // necessary to synchronize with noc simulator 
 unsigned char is_reading[MAX_N_CORES];
 int flits_remaining[MAX_N_CORES]; 
+unsigned char rx_first[MAX_N_CORES];	// the next read is the dummy read which starts the reception of a packet
+int tx_flits[MAX_N_CORES];		// flits left of the packet being written (0: next flit is a header, -1: next flit is the payload)
 extern Router *routers;
 extern NetworkInterface *network_interfaces;
 extern Core *cores;
@@ -157,8 +224,12 @@ unsigned int GPIOAIN[MAX_N_CORES];
 unsigned int GPIO0OUT[MAX_N_CORES];
 
 unsigned long long cpu_cycles[MAX_N_CORES];
+unsigned long long sleep_cycles[MAX_N_CORES];
+unsigned int sleep_until[MAX_N_CORES];
+unsigned char sleeping[MAX_N_CORES];
 unsigned int ins_counter_op[0x40][MAX_N_CORES], ins_counter_func[0x40][MAX_N_CORES], ins_counter_rt[0x40][MAX_N_CORES];
 unsigned long long max_cycles=-1;
+pthread_mutex_t clock_lock = PTHREAD_MUTEX_INITIALIZER;
 char sim_metric = '\0';
 int uart_delay[MAX_N_CORES];
 double est_energy[MAX_N_CORES];
@@ -170,9 +241,23 @@ double bus_est_energy;
 unsigned int flits_sent[MAX_N_CORES];
 unsigned int flits_received[MAX_N_CORES];
 unsigned int broadcasts[MAX_N_CORES];
+
+/* DMA network interface state. descriptors are two words in SRAM: buffer address and OWN | length (in flits) */
+unsigned int dma_ctrl[MAX_N_CORES], dma_tx_ring[MAX_N_CORES], dma_rx_ring[MAX_N_CORES], dma_ring_size[MAX_N_CORES];
+unsigned int dma_tx_head[MAX_N_CORES], dma_rx_head[MAX_N_CORES], dma_status[MAX_N_CORES];
+unsigned int dma_tx_addr[MAX_N_CORES], dma_tx_len[MAX_N_CORES], dma_rx_addr[MAX_N_CORES];
+int dma_tx_flit[MAX_N_CORES], dma_rx_flit[MAX_N_CORES], dma_rx_len[MAX_N_CORES];
 char logout_string[] = "./reports/logout\0\0\0\0\0\0\0\0\0\0\0";
 char outout_string[] = "./reports/out\0\0\0\0\0\0\0\0\0\0\0";
 FILE *log_out[MAX_N_CORES], *out_out[MAX_N_CORES];
+Decoded *decode_cache[MAX_N_CORES];
+Decoded decode_uncached[MAX_N_CORES];
+int translate_blocks = 0;
+Block *block_table[MAX_N_CORES];
+unsigned char *block_pages[MAX_N_CORES];
+unsigned int block_flushes[MAX_N_CORES];
+long long block_ahead[MAX_N_CORES];	// cycles the instruction being run by a block is ahead of the global cycle
+Spin spins[MAX_N_CORES];
 
 char *itoa(unsigned int num){
 	static char buf[12];
@@ -214,6 +299,7 @@ static int show_cpu_stats(unsigned char *output, int cpu_n){
 
 	fprintf(rpt_ptr, "\nCode Execution Report - Core %d", cpu_n);
 	fprintf(rpt_ptr, "\n\nCPU cycles: %ld",cpu_cycles[cpu_n]);
+	fprintf(rpt_ptr, "\nSleep cycles: %llu (active: %llu)",sleep_cycles[cpu_n], cpu_cycles[cpu_n] - sleep_cycles[cpu_n]);
 	fprintf(rpt_ptr, "\nWCET: %.04fms", (((double)cpu_cycles[cpu_n] / (double)reference_clock))*1000);
 	fprintf(rpt_ptr, "\nEstimated energy consumption: %lfJ (20587 gates Plasma CPU core, CMOS TSMC 0.35um)", est_energy[cpu_n]);
 	fprintf(rpt_ptr, "\n\nInstructions (MIPS I instruction set):\n");
@@ -422,13 +508,53 @@ static int show_mpsoc_stats(unsigned char *output){
 		k += broadcasts[j];
 	fprintf(rpt_ptr, "\n\nBroadcasts: %ld",k);
 	for(j=0;j<n_cores;j++)
-		fprintf(rpt_ptr, "\n    core %d: %ld",j, flits_received[j]);
+		fprintf(rpt_ptr, "\n    core %d: %ld",j, broadcasts[j]);
 	fprintf(rpt_ptr, "\n");
 
 	fclose(rpt_ptr);	
 }
 	
 
+// registers which reading does not change, and which only change on an interrupt source, the uart or the network
+static int spin_register(unsigned int address, int cpu_n, unsigned int *value){
+	NetworkInterface *ni;
+
+	switch(address){
+		case IRQ_MASK:
+			*value = HWMemory[1][cpu_n];
+			return 1;
+		case IRQ_STATUS:
+			*value = HWMemory[2][cpu_n];
+			return 1;
+		case GPIOA_IN:
+			*value = GPIOAIN[cpu_n];
+			return 1;
+		case NOC_STATUS:
+			ni = getNetworkInterface(cpu_n);
+			*value = isEmpty(getBuffer(ni, PLASMA));
+			return 1;
+		case FREQUENCY_REG:
+			*value = HWMemory[3][cpu_n];
+			return 1;
+		case TICK_TIME_REG:
+			*value = HWMemory[4][cpu_n];
+			return 1;
+	}
+	return 0;
+}
+
+// an MMIO read: a single polling read per instruction (or block) may be part of a spin
+static void spin_read(unsigned int address, int cpu_n){
+	Spin *p = &spins[cpu_n];
+
+	if (!(p->io & SPIN_POLL) && spin_register(address, cpu_n, &p->poll_value)){
+		p->io |= SPIN_POLL;
+		p->poll_address = address;
+	}else{
+		p->io |= SPIN_OTHER;
+	}
+}
+
 static int mem_read(State *s, int size, unsigned int address, int cpu_n){
 	unsigned int value=0;
 	unsigned int *ptr;
@@ -438,6 +564,9 @@ static int mem_read(State *s, int size, unsigned int address, int cpu_n){
 	Buffer *buffer;
 	Port *port;
 
+	if (address >= MISC_BASE)
+		spin_read(address, cpu_n);
+
 	switch(address){
 		case UART_READ:
 //			if(kbhit())
@@ -456,7 +585,7 @@ static int mem_read(State *s, int size, unsigned int address, int cpu_n){
 //				HWMemory[2][cpu_n] |= IRQ_UART_READ_AVAILABLE;
 			return HWMemory[2][cpu_n];
 		case COUNTER_REG:
-			return (unsigned int)cpu_cycles[cpu_n];
+			return (unsigned int)(cpu_cycles[cpu_n] + block_ahead[cpu_n]);
 		case NOC_READ:
 
 			if(HWMemory[2][cpu_n] & IRQ_NOC_READ)
@@ -466,8 +595,9 @@ static int mem_read(State *s, int size, unsigned int address, int cpu_n){
 
 			core = getCore(cpu_n);
 			port = &(core->port);
-			if(flits_remaining[cpu_n] == OS_PACKET_SIZE+1)
+			if(rx_first[cpu_n])
 			{
+				rx_first[cpu_n] = 0;
 				flits_remaining[cpu_n]--;
 				return 0;
 			}
@@ -493,6 +623,13 @@ static int mem_read(State *s, int size, unsigned int address, int cpu_n){
 			return HWMemory[4][cpu_n];
 		case LOG_FACILITY:
 			return 0xa5a5a5a5;
+		case NOC_DMA_CTRL:
+			return dma_ctrl[cpu_n];
+		case NOC_DMA_STATUS:
+			value = dma_status[cpu_n];
+			dma_status[cpu_n] = 0;
+			HWMemory[2][cpu_n] &= ~IRQ_NOC_READ;
+			return value;
 	}
 
 	ptr = (unsigned int *)(s->mem + (address % MEM_SIZE));
@@ -523,6 +660,59 @@ static int mem_read(State *s, int size, unsigned int address, int cpu_n){
 	return(value);
 }
 
+// a store over a decoded instruction discards it, so self modifying code and code loaded at run time still work
+static void decode_invalidate(int cpu_n, unsigned int address){
+	Decoded *d;
+
+	address = (address % MEM_SIZE) & ~3;
+	d = &decode_cache[cpu_n][(address >> 2) & (DECODE_CACHE_SIZE - 1)];
+	if (d->tag == address)
+		d->tag = DECODE_INVALID;
+}
+
+// drops all translated blocks of a core, once one of its code pages is written
+static void block_flush(int cpu_n){
+	int i;
+
+	for(i=0;i<BLOCK_TABLE_SIZE;i++){
+		block_table[cpu_n][i].tag = DECODE_INVALID;
+		block_table[cpu_n][i].count = 0;
+		block_table[cpu_n][i].len = -1;
+	}
+	memset(block_pages[cpu_n], 0, MEM_SIZE >> BLOCK_PAGE_SHIFT);
+	block_flushes[cpu_n]++;
+}
+
+// fetches and decodes the instruction at pc. instructions in RAM are decoded only once, until overwritten
+static Decoded *decode(State *s, unsigned int pc, int cpu_n){
+	Decoded *d;
+	unsigned int opcode, offset;
+
+	offset = pc % MEM_SIZE;
+	if (pc < MISC_BASE && (pc & 3) == 0){
+		d = &decode_cache[cpu_n][(offset >> 2) & (DECODE_CACHE_SIZE - 1)];
+		if (d->tag == offset)
+			return d;
+	}else{
+		d = &decode_uncached[cpu_n];
+	}
+
+	opcode = mem_read(s, 4, pc, cpu_n);
+	d->tag = d == &decode_uncached[cpu_n] ? DECODE_INVALID : offset;
+	d->opcode = opcode;
+	d->op = (opcode >> 26) & 0x3f;
+	d->rs = (opcode >> 21) & 0x1f;
+	d->rt = (opcode >> 16) & 0x1f;
+	d->rd = (opcode >> 11) & 0x1f;
+	d->re = (opcode >> 6) & 0x1f;
+	d->func = opcode & 0x3f;
+	d->imm = opcode & 0xffff;
+	d->imm_shift = (((int)(short)d->imm) << 2) - 4;
+	d->target = (opcode << 6) >> 4;
+
+	return d;
+}
+
 static void mem_write(State *s, int size, int unsigned address, unsigned int value, FILE *std_out, int cpu_n){
 	static int char_count=0;
 	unsigned int *ptr;
@@ -530,6 +720,8 @@ static void mem_write(State *s, int size, int unsigned address, unsigned int val
 	Core *core;
 	Port *port;	
 
+	spins[cpu_n].io |= SPIN_OTHER;
+
 	switch(address){
 		case UART_WRITE:
 			HWMemory[2][cpu_n] &= ~IRQ_UART_WRITE_AVAILABLE;
@@ -548,14 +740,36 @@ static void mem_write(State *s, int size, int unsigned address, unsigned int val
 			
 			core = getCore(cpu_n);
 			port = &(core->port);
+			// the first flit of each packet is the header, a multicast one covers a rectangle of cores.
+			// packets are variable sized, the second flit holds the number of flits that follow it
+			if( tx_flits[cpu_n] == 0 )
+			{
+				if( isMulticast(value) )
+					broadcasts[cpu_n]++;
+				tx_flits[cpu_n] = -1;
+			}
+			else if( tx_flits[cpu_n] == -1 )
+			{
+				tx_flits[cpu_n] = value;
+			}
+			else
+			{
+				tx_flits[cpu_n]--;
+			}
+			flits_sent[cpu_n]++;
 			is_sending[cpu_n] = ON;
 			port->out = value;
 			port->out_request = ON;
 			port->out_ack = OFF;			
+#ifndef BUS
+			wakeNode(cpu_n);
+#endif
 			return;
 			
 		case FREQUENCY_REG:
 			if ((value == 25000000) || (value == 33333333) || (value == 50000000) || (value == 66666666) || (value == 100000000)){
+				// the simulation length and the reference clock are shared by all cores (and threads)
+				pthread_mutex_lock(&clock_lock);
 				HWMemory[3][cpu_n] = value;
 				switch (sim_metric){
 					case 'c':
@@ -579,6 +793,7 @@ static void mem_write(State *s, int size, int unsigned address, unsigned int val
 							break;
 				}
 				reference_clock = value;
+				pthread_mutex_unlock(&clock_lock);
 				printf("\nClock frequency reconfigured for %d MHz on core %d", (value/1000000), cpu_n);
 				fflush(stdout);
 			}else{
@@ -608,6 +823,27 @@ static void mem_write(State *s, int size, int unsigned address, unsigned int val
 				}
 			}
 			return;
+		case SLEEP_REG:
+			sleep_until[cpu_n] = value;
+			sleeping[cpu_n] = 1;
+			return;
+		case NOC_DMA_CTRL:
+			dma_ctrl[cpu_n] = value & 1;
+			dma_tx_head[cpu_n] = 0;
+			dma_rx_head[cpu_n] = 0;
+			dma_tx_flit[cpu_n] = -1;
+			dma_rx_flit[cpu_n] = -1;
+			dma_status[cpu_n] = 0;
+			return;
+		case NOC_DMA_TX_RING:
+			dma_tx_ring[cpu_n] = value;
+			return;
+		case NOC_DMA_RX_RING:
+			dma_rx_ring[cpu_n] = value;
+			return;
+		case NOC_DMA_RING_SIZE:
+			dma_ring_size[cpu_n] = value;
+			return;
 		case EXIT_TRAP:
 			printf("[BP, CPU %d]", cpu_n);
 			fflush(stdout);
@@ -616,6 +852,9 @@ static void mem_write(State *s, int size, int unsigned address, unsigned int val
 	}
 
 	ptr = (unsigned int *)(s->mem + (address % MEM_SIZE));
+	decode_invalidate(cpu_n, address);
+	if (translate_blocks && block_pages[cpu_n][(address % MEM_SIZE) >> BLOCK_PAGE_SHIFT])
+		block_flush(cpu_n);
 
 	switch(size){
 		case 4:
@@ -637,6 +876,82 @@ static void mem_write(State *s, int size, int unsigned address, unsigned int val
 	}
 }
 
+/*
+DMA network interface: moves flits between the core port and packet buffers in SRAM, following the TX and RX
+descriptor rings, one flit per cycle in each direction. The core keeps running while packets are transferred.
+*/
+static void cycle_dma(State *s, int cpu_n){
+	Core *core;
+	Port *port;
+	unsigned int desc;
+
+	core = getCore(cpu_n);
+	port = &(core->port);
+
+	// transmission
+	if(port->out_request == ON && port->out_ack == ON){
+		port->out = 0;
+		port->out_request = OFF;
+		port->out_ack = OFF;
+	}
+	if(dma_tx_flit[cpu_n] < 0){
+		desc = dma_tx_ring[cpu_n] + dma_tx_head[cpu_n] * 8;
+		if(mem_read(s, 4, desc + 4, cpu_n) & DMA_DESC_OWN){
+			dma_tx_addr[cpu_n] = mem_read(s, 4, desc, cpu_n);
+			dma_tx_len[cpu_n] = mem_read(s, 4, desc + 4, cpu_n) & 0xffff;
+			dma_tx_flit[cpu_n] = 0;
+		}
+	}
+	if(dma_tx_flit[cpu_n] >= 0 && port->out_request == OFF){
+		if((unsigned int)dma_tx_flit[cpu_n] < dma_tx_len[cpu_n]){
+			port->out = mem_read(s, 2, dma_tx_addr[cpu_n] + dma_tx_flit[cpu_n] * 2, cpu_n);
+			if(dma_tx_flit[cpu_n] == 0 && isMulticast(port->out))
+				broadcasts[cpu_n]++;
+			flits_sent[cpu_n]++;
+			port->out_request = ON;
+			port->out_ack = OFF;
+			dma_tx_flit[cpu_n]++;
+#ifndef BUS
+			wakeNode(cpu_n);
+#endif
+		}else{
+			desc = dma_tx_ring[cpu_n] + dma_tx_head[cpu_n] * 8;
+			mem_write(s, 4, desc + 4, dma_tx_len[cpu_n], NULL, cpu_n);
+			dma_tx_head[cpu_n] = (dma_tx_head[cpu_n] + 1) % dma_ring_size[cpu_n];
+			dma_tx_flit[cpu_n] = -1;
+			dma_status[cpu_n] |= DMA_STATUS_TX;
+		}
+	}
+
+	// reception
+	if(port->in_request == ON && port->in_ack == OFF){
+		if(dma_rx_flit[cpu_n] < 0){
+			desc = dma_rx_ring[cpu_n] + dma_rx_head[cpu_n] * 8;
+			if(mem_read(s, 4, desc + 4, cpu_n) & DMA_DESC_OWN){
+				dma_rx_addr[cpu_n] = mem_read(s, 4, desc, cpu_n);
+				dma_rx_flit[cpu_n] = 0;
+			}
+		}
+		if(dma_rx_flit[cpu_n] >= 0){
+			// packets are variable sized: the payload flit gives the size. flits beyond OS_PACKET_SIZE are dropped
+			if(dma_rx_flit[cpu_n] == 1)
+				dma_rx_len[cpu_n] = port->in + 2;
+			if(dma_rx_flit[cpu_n] < OS_PACKET_SIZE)
+				mem_write(s, 2, dma_rx_addr[cpu_n] + dma_rx_flit[cpu_n] * 2, port->in, NULL, cpu_n);
+			port->in_ack = ON;
+			flits_received[cpu_n]++;
+			if(++dma_rx_flit[cpu_n] > 1 && dma_rx_flit[cpu_n] >= dma_rx_len[cpu_n]){
+				desc = dma_rx_ring[cpu_n] + dma_rx_head[cpu_n] * 8;
+				mem_write(s, 4, desc + 4, dma_rx_len[cpu_n] < OS_PACKET_SIZE ? dma_rx_len[cpu_n] : OS_PACKET_SIZE, NULL, cpu_n);
+				dma_rx_head[cpu_n] = (dma_rx_head[cpu_n] + 1) % dma_ring_size[cpu_n];
+				dma_rx_flit[cpu_n] = -1;
+				dma_status[cpu_n] |= DMA_STATUS_RX;
+				HWMemory[2][cpu_n] |= IRQ_NOC_READ;
+			}
+		}
+	}
+}
+
 void mult_big_unsigned(unsigned int a, unsigned int b, unsigned int *hi, unsigned int *lo){
 	unsigned int ahi, alo, bhi, blo;
 	unsigned int c0, c1, c2;
@@ -684,7 +999,8 @@ void mult_big_signed(int a, int b, unsigned int *hi, unsigned int *lo){
 }
 
 //execute one cycle of a Plasma CPU
-void cycle(State *s, int show_mode, int cpu_n, FILE *std_out, int *pause_cycles, int *irq){
+// executes a decoded instruction, the one at pc
+static void execute(State *s, Decoded *d, int show_mode, int cpu_n, FILE *std_out, int *pause_cycles){
 	unsigned int opcode;
 	unsigned int op, rs, rt, rd, re, func, imm, target;
 	int imm_shift, branch=0, lbranch=2;
@@ -692,29 +1008,16 @@ void cycle(State *s, int show_mode, int cpu_n, FILE *std_out, int *pause_cycles,
 	unsigned int *u=(unsigned int*)s->r;
 	unsigned int ptr, epc, rSave;
 
-	*pause_cycles = 0;
-
-	if (HWMemory[2][cpu_n] & IRQ_UART_WRITE_AVAILABLE){
-		if ((*irq) && (!s->jump_or_branch)){
-			s->epc = s->pc+4;
-//			s->pc_next = 0x10000060;	// address of simulator ISR
-			s->pc_next = 0x10000050;	// address of simulator ISR
-			s->no_execute_branch_delay_slot = 1;
-			*irq = 0;
-			s->status = 0;
-		}
-	}
-
-	opcode = mem_read(s, 4, s->pc, cpu_n);
-	op = (opcode >> 26) & 0x3f;
-	rs = (opcode >> 21) & 0x1f;
-	rt = (opcode >> 16) & 0x1f;
-	rd = (opcode >> 11) & 0x1f;
-	re = (opcode >> 6) & 0x1f;
-	func = opcode & 0x3f;
-	imm = opcode & 0xffff;
-	imm_shift = (((int)(short)imm) << 2) - 4;
-	target = (opcode << 6) >> 4;
+	opcode = d->opcode;
+	op = d->op;
+	rs = d->rs;
+	rt = d->rt;
+	rd = d->rd;
+	re = d->re;
+	func = d->func;
+	imm = d->imm;
+	imm_shift = d->imm_shift;
+	target = d->target;
 	ptr = (short)imm + r[rs];
 	r[0] = 0;
 	if(show_mode){
@@ -1122,24 +1425,668 @@ void cycle(State *s, int show_mode, int cpu_n, FILE *std_out, int *pause_cycles,
 	}
 }
 
-int do_debug(State *s[], FILE *std_out[]){
-	int ch;
-	unsigned char mem;
-	int i, j=0, watch=0, addr, k=0, l, m, n[MAX_N_CORES];
-	int pause_cpu[MAX_N_CORES];
-	int irq_counter[MAX_N_CORES];
-	char report_string[]= "./reports/report\0\0\0\0\0\0\0\0\0\0";
-	unsigned long long gcycles = 0;
+void cycle(State *s, int show_mode, int cpu_n, FILE *std_out, int *pause_cycles, int *irq){
+	*pause_cycles = 0;
+
+	if (HWMemory[2][cpu_n] & IRQ_UART_WRITE_AVAILABLE){
+		if ((*irq) && (!s->jump_or_branch)){
+			s->epc = s->pc+4;
+//			s->pc_next = 0x10000060;	// address of simulator ISR
+			s->pc_next = 0x10000050;	// address of simulator ISR
+			s->no_execute_branch_delay_slot = 1;
+			*irq = 0;
+			s->status = 0;
+			spins[cpu_n].io |= SPIN_OTHER;
+		}
+	}
+
+	execute(s, decode(s, s->pc, cpu_n), show_mode, cpu_n, std_out, pause_cycles);
+}
+
+int pause_cpu[MAX_N_CORES];
+int irq_counter[MAX_N_CORES];
+int halted[MAX_N_CORES];		// the core reached its breakpoint on a previous cycle
 
+/*
+	BLOCK TRANSLATION
+
+	entry points are profiled and, once hot, the block that starts there (straight line code up to a branch
+	and its delay slot) is kept decoded. a block runs back to back, ahead of the global cycle, as long as
+	nothing outside the core can observe or interfere with it: no MMIO access but polling the counter or an
+	idle transmission status (the block stops before others) and no interrupt that could be raised before
+	the block ends. the core then stalls for the cycles the
+	block took, so cycle counts, energy and instruction counters are the same as interpreting it.
+*/
+
+// instructions a block may hold: all but coprocessor, system call, break, sync and unknown instructions
+static int block_insn(Decoded *d){
+	switch(d->op){
+		case 0x00:
+			switch(d->func){
+				case 0x00: case 0x02: case 0x03: case 0x04: case 0x06: case 0x07: case 0x08: case 0x09:
+				case 0x0a: case 0x0b: case 0x10: case 0x11: case 0x12: case 0x13: case 0x18: case 0x19:
+				case 0x1a: case 0x1b: case 0x20: case 0x21: case 0x22: case 0x23: case 0x24: case 0x25:
+				case 0x26: case 0x27: case 0x2a: case 0x2b: case 0x2d: case 0x31: case 0x32: case 0x33:
+				case 0x34: case 0x36:
+					return 1;
+			}
+			return 0;
+		case 0x01:
+			return d->rt <= 0x03 || (d->rt >= 0x10 && d->rt <= 0x13);
+		case 0x02: case 0x03: case 0x04: case 0x05: case 0x06: case 0x07: case 0x08: case 0x09:
+		case 0x0a: case 0x0b: case 0x0c: case 0x0d: case 0x0e: case 0x0f: case 0x14: case 0x15:
+		case 0x16: case 0x17: case 0x20: case 0x21: case 0x22: case 0x23: case 0x24: case 0x25:
+		case 0x26: case 0x28: case 0x29: case 0x2a: case 0x2b: case 0x2e: case 0x2f: case 0x30:
+		case 0x38:
+			return 1;
+	}
+	return 0;
+}
+
+static int block_branch(Decoded *d){
+	return (d->op >= 0x01 && d->op <= 0x07) || (d->op >= 0x14 && d->op <= 0x17) || (d->op == 0x00 && (d->func == 0x08 || d->func == 0x09));
+}
+
+static int block_mem(Decoded *d){
+	return d->op >= 0x20;
+}
+
+static int block_load(Decoded *d){
+	return (d->op >= 0x20 && d->op <= 0x26) || d->op == 0x2f || d->op == 0x30;
+}
+
+// MMIO reads a block may do: polling the counter, or the transmission status while nothing is being sent
+static int block_mmio(Decoded *d, unsigned int address, int cpu_n){
+	NetworkInterface *ni;
+
+	if (!block_load(d))
+		return 0;
+	if (address == COUNTER_REG)
+		return 1;
+
+	ni = getNetworkInterface(cpu_n);
+
+	return address == NOC_STATUS && isEmpty(getBuffer(ni, PLASMA));
+}
+
+static void block_translate(State *s, int cpu_n, Block *b){
+	Decoded *d;
+	unsigned int pc = s->pc;
+
+	b->len = 0;
+	while(b->len < BLOCK_MAX){
+		d = decode(s, pc, cpu_n);
+		// uncached instructions have no code page to watch for writes
+		if (d->tag == DECODE_INVALID || !block_insn(d))
+			break;
+		b->insn[b->len++] = *d;
+		block_pages[cpu_n][d->tag >> BLOCK_PAGE_SHIFT] = 1;
+		if (b->len > 1 && block_branch(&b->insn[b->len - 2]))
+			break;
+		pc += 4;
+	}
+	b->count = BLOCK_THRESHOLD;
+}
+
+// a flit reaches the network interface at most once per network cycle, and a packet reaching an idle
+// router waits for the routing delay. a pending acknowledge may expose the next packet on the buffer
+static long long block_noc_horizon(int cpu_n){
+	NetworkInterface *ni = getNetworkInterface(cpu_n);
+	Buffer *buffer = getBuffer(ni, NOC);
+	Core *core = getCore(cpu_n);
+	int missing;
+#ifndef BUS
+	Router *router = getRouter(cpu_n);
+	int i;
+#endif
+
+	if (hasPacket(buffer) || core->port.in_ack == ON || getPort(ni, PLASMA)->out_ack == ON)
+		return 0;
+	missing = buffer->size < 2 ? 2 - buffer->size : peek(buffer, 1) + 2 - buffer->size;
+
+#ifndef BUS
+	for(i=0;i<ROUTERSIZE;i++)
+		if (router->status[i] != IDLE || !isEmpty(getBuffer(router, i)))
+			break;
+	if (i == ROUTERSIZE)
+		return 1 + (long long)(ROUTING_ALGORITHM_DELAY + missing - 1) * CPU_NETWORK_CLK_RATIO;
+#endif
+	if (missing < 2)
+		return 1;
+
+	return 1 + (long long)(missing - 2) * CPU_NETWORK_CLK_RATIO;
+}
+
+// cycles from now in which a block may start instructions: no interrupt is raised and the simulation goes on
+static long long block_horizon(State *s, int cpu_n){
+	long long horizon, cycles, tick;
+
+	if (cpu_cycles[cpu_n] >= max_cycles)
+		return 0;
+	horizon = max_cycles - cpu_cycles[cpu_n];
+	if (s->status != 1)
+		return horizon;
+
+	if (HWMemory[1][cpu_n] & (IRQ_COUNTER18 | IRQ_COUNTER18_NOT)){
+		tick = HWMemory[4][cpu_n];
+		if (tick == 0 || (tick & (tick - 1)))
+			return 0;
+		cycles = ((cpu_cycles[cpu_n] + 1) | (tick - 1)) - cpu_cycles[cpu_n];
+		if (cycles < horizon)
+			horizon = cycles;
+	}
+	if ((HWMemory[1][cpu_n] & IRQ_NOC_READ) && flits_remaining[cpu_n] == 0){
+		cycles = block_noc_horizon(cpu_n);
+		if (cycles < horizon)
+			horizon = cycles;
+	}
+
+	return horizon;
+}
+
+// runs the translated block at pc, if there is one. the core stalls for the cycles it took
+static int cycle_block(State *s, int cpu_n, FILE *std_out){
+	Block *b;
+	Decoded *d;
+	unsigned int offset, address, flushes;
+	long long horizon, cycles = 0;
+	int i, pause;
+
+	if (irq_counter[cpu_n] || dma_ctrl[cpu_n] || (unsigned int)s->pc >= MISC_BASE || (s->pc & 3))
+		return 0;
+
+	offset = (unsigned int)s->pc % MEM_SIZE;
+	b = &block_table[cpu_n][(offset >> 2) & (BLOCK_TABLE_SIZE - 1)];
+	if (b->tag != offset){
+		if (--b->count > 0)
+			return 0;
+		b->tag = offset;
+		b->count = 0;
+		b->len = -1;
+	}
+	if (b->len < 0){
+		if (++b->count < BLOCK_THRESHOLD)
+			return 0;
+		block_translate(s, cpu_n, b);
+	}
+	b->count = BLOCK_THRESHOLD;
+
+	horizon = block_horizon(s, cpu_n);
+	flushes = block_flushes[cpu_n];
+	for(i=0;i<b->len && cycles < horizon;i++){
+		d = &b->insn[i];
+		if ((unsigned int)s->pc >= MISC_BASE || (unsigned int)s->pc % MEM_SIZE != d->tag)
+			break;
+		if (block_mem(d)){
+			address = (short)d->imm + s->r[d->rs];
+			if (address >= MISC_BASE && !block_mmio(d, address, cpu_n))
+				break;
+		}
+		pause = 0;
+		block_ahead[cpu_n] = cycles;
+		execute(s, d, 0, cpu_n, std_out, &pause);
+		cycles += 1 + pause;
+		if (block_flushes[cpu_n] != flushes)
+			break;
+	}
+	block_ahead[cpu_n] = 0;
+	if (cycles == 0)
+		return 0;
+	pause_cpu[cpu_n] = cycles - 1;
+
+	return 1;
+}
+
+/*
+	CYCLE PHASES OF A CORE, SHARED BY THE SERIAL AND THE PARALLEL SIMULATION LOOPS
+*/
+
+// the counter interrupt lines swap on each tick
+static void tick_toggle(int j){
+	if (HWMemory[2][j] & IRQ_COUNTER18){
+		HWMemory[2][j] &= ~IRQ_COUNTER18;
+		HWMemory[2][j] |= IRQ_COUNTER18_NOT;
+	}else{
+		HWMemory[2][j] &= ~IRQ_COUNTER18_NOT;
+		HWMemory[2][j] |= IRQ_COUNTER18;
+	}
+}
+
+// timer, uart and noc interrupt sources, evaluated at the beginning of each cycle
+static void cycle_irq(State *s, int j){
 	Core *core;
 	NetworkInterface *ni;
 	Buffer *buffer;
 	Port *port;
 
+	if ((cpu_cycles[j] & ((long long)HWMemory[4][j] - 1)) == ((long long)HWMemory[4][j] - 1)){
+		if (HWMemory[1][j] & (IRQ_COUNTER18 | IRQ_COUNTER18_NOT)){
+//		if ((HWMemory[1][j] & (IRQ_COUNTER18 | IRQ_COUNTER18_NOT)) && ((HWMemory[2][j] & IRQ_NOC_READ) == 0) ){
+			if(s->status == 1) irq_counter[j] = 1;
+		}
+		tick_toggle(j);
+	}
+
+	if ((!(HWMemory[2][j] & IRQ_UART_WRITE_AVAILABLE)) && (uart_delay[j]) > 0){
+		uart_delay[j]--;
+		io_counter[j]++;
+	}else{
+		uart_delay[j] = UART_DELAY;
+		HWMemory[2][j] |= IRQ_UART_WRITE_AVAILABLE;
+	}
+
+	core = getCore(j);
+	port = &(core->port);
+	ni = getNetworkInterface(j);
+	buffer = getBuffer(ni, NOC);
+	if(dma_ctrl[j])
+	// DMA interface: the completion irq is kept pending until the status register is read
+	{
+		if(HWMemory[2][j] & HWMemory[1][j] & IRQ_NOC_READ)
+		{
+			sleeping[j] = 0;
+			if(s->status == 1 && irq_counter[j] == 0)
+				irq_counter[j] = 2;
+		}
+	}
+	else if(hasPacket(buffer) && port->in_request == ON && flits_remaining[j] == 0 )//&& irq_counter[j] == 0)
+	// to create a noc interrupt a whole packet needs to be on the buffer, requesting to send the first flit,
+	// there also can't be any thing on the idle buffer and a clock interrupt can't be generated at the same cycle
+	{
+		if(HWMemory[1][j] & IRQ_NOC_READ)
+		// não mascarada					
+		{
+			// a pending packet wakes up a sleeping core, even with interrupts disabled
+			sleeping[j] = 0;
+			if(s->status == 1)
+			// interrupções habilitadas
+			{
+				flits_remaining[j] = peek(buffer, 1) + 3;
+				rx_first[j] = 1;
+//				irq_counter[j] = 1;
+				irq_counter[j] = 2;
+				HWMemory[2][j] |= IRQ_NOC_READ;
+			}
+		}
+	}
+}
+
+// releases the core port once the flit being sent was acknowledged
+static void cycle_port(int j){
+	Core *core;
+	Port *port;
+
+	if(is_sending[j] == ON)
+	{
+		core = getCore(j);
+		port = &(core->port);
+		if(port->out_ack == ON)
+		{
+			port->out = 0;
+			port->out_request = OFF;
+			port->out_ack = OFF;
+			is_sending[j] = OFF;
+		}
+	}
+}
+
+/*
+	SPIN DETECTION
+
+	a core which reads the same value from a register that only changes on an event (an interrupt source,
+	the uart or the network), with nothing but that read done in between (no store, no other MMIO access,
+	no interrupt) and reaching the same state (registers, pc and stall) right after it, is spinning: each
+	iteration of the loop takes the same cycles and adds the same to the instruction and energy counters
+	until the register changes. whole iterations are skipped by the idle fast-forward, from any point of
+	the loop, as long as the register still holds the value read.
+*/
+
+// called once an instruction (or block) made an MMIO access or a store
+static void spin_check(State *s, int j){
+	Spin *p = &spins[j];
+	unsigned int value;
+	int i;
+
+	if (p->io != SPIN_POLL || irq_counter[j] || !spin_register(p->poll_address, j, &value) || value != p->poll_value){
+		p->io = 0;
+		p->valid = 0;
+		p->period = 0;
+		return;
+	}
+	p->io = 0;
+
+	if (p->valid && p->address == p->poll_address && p->value == value && p->pause == pause_cpu[j] &&
+		memcmp(&p->state, s, sizeof(State)) == 0){
+		p->period = cpu_cycles[j] - p->cycle;
+		for(i=0;i<0x40;i++)
+			p->ops_delta[i] = ins_counter_op[i][j] - p->ops[i];
+		p->energy_delta = est_energy[j] - p->energy;
+	}else{
+		p->period = 0;
+	}
+
+	memcpy(&p->state, s, sizeof(State));
+	p->cycle = cpu_cycles[j];
+	p->address = p->poll_address;
+	p->value = value;
+	p->pause = pause_cpu[j];
+	for(i=0;i<0x40;i++)
+		p->ops[i] = ins_counter_op[i][j];
+	p->energy = est_energy[j];
+	p->valid = 1;
+}
+
+// the core is spinning, has not yet reached its next polling read and will read the same value, so it may skip whole iterations
+static int spin_ready(int j){
+	unsigned int value;
+
+	return spins[j].period > 0 && cpu_cycles[j] - spins[j].cycle <= (unsigned long long)spins[j].period && irq_counter[j] == 0 &&
+		spin_register(spins[j].address, j, &value) && value == spins[j].value;
+}
+
+// skips iterations of a spin, adding what they would have counted
+static void spin_skip(int j, long long cycles){
+	Spin *p = &spins[j];
+	unsigned int n;
+	int i;
+
+	n = cycles / p->period;
+	for(i=0;i<0x40;i++){
+		ins_counter_op[i][j] += n * p->ops_delta[i];
+		p->ops[i] += n * p->ops_delta[i];
+	}
+	est_energy[j] += n * p->energy_delta;
+	p->energy += n * p->energy_delta;
+	p->cycle += cycles;
+}
+
+// one cycle of a core: it sleeps, stalls or executes an instruction
+static void cycle_cpu(State *s, int j, FILE *std_out){
+	if (sleeping[j] && (int)(sleep_until[j] - (unsigned int)cpu_cycles[j]) <= 0)
+		sleeping[j] = 0;
+	if (sleeping[j])
+		sleep_cycles[j]++;
+	else if (pause_cpu[j] == 0 && is_sending[j] == OFF){
+		if (!translate_blocks || !cycle_block(s, j, std_out))
+			cycle(s, 0, j, std_out, &pause_cpu[j], &irq_counter[j]);
+		if (spins[j].io)
+			spin_check(s, j);
+	}
+	else if(pause_cpu[j] >= 1)
+		pause_cpu[j]--;
+
+	if (cpu_cycles[j] >= max_cycles){
+		brkpt[j] = 1;
+	}
+	cpu_cycles[j]++;
+}
+
+/*
+	IDLE FAST-FORWARD
+
+	while no core executes an instruction (they sleep, stall after a translated block or a long operation,
+	spin on a register or have stopped) and no flit is on the network, cycles only update counters. they
+	are skipped at once, up to the first cycle in which something happens: a core resumes or wakes up, a
+	timer interrupt is raised or the counter bits of a polled status toggle, the uart becomes available or
+	the simulation ends. spinning cores skip whole iterations, so the cycles skipped are a multiple of the
+	period of each of them.
+*/
+
+// cycles from now in which a core only counts them (-1: no limit)
+static long long quiet_cycles(State *s, int j){
+	long long cycles, tick;
+	int wake, spinning = 0;
+
+	if (brkpt[j])
+		return halted[j] ? -1 : 0;
+	if (is_sending[j] || dma_ctrl[j] || cpu_cycles[j] >= max_cycles)
+		return 0;
+	cycles = max_cycles - cpu_cycles[j];
+
+	if (sleeping[j]){
+		wake = (int)(sleep_until[j] - (unsigned int)cpu_cycles[j]);
+		if (wake <= 0)
+			return 0;
+		if (wake < cycles)
+			cycles = wake;
+	}else if (spin_ready(j)){
+		spinning = 1;
+	}else if (pause_cpu[j] < cycles){
+		cycles = pause_cpu[j];
+	}
+
+	tick = HWMemory[4][j];
+	if (tick & (tick - 1))
+		return 0;
+	if (tick && (((HWMemory[1][j] & (IRQ_COUNTER18 | IRQ_COUNTER18_NOT)) && s->status == 1) || spinning))
+		if ((long long)((cpu_cycles[j] | (tick - 1)) - cpu_cycles[j]) < cycles)
+			cycles = (cpu_cycles[j] | (tick - 1)) - cpu_cycles[j];
+
+	if (!(HWMemory[2][j] & IRQ_UART_WRITE_AVAILABLE) && uart_delay[j] > 0 && uart_delay[j] < cycles)
+		cycles = uart_delay[j];
+
+	// the uart becomes available on the next cycle
+	if (spinning && !(HWMemory[2][j] & IRQ_UART_WRITE_AVAILABLE) && uart_delay[j] <= 0)
+		return 0;
+
+	if (spinning)
+		cycles -= cycles % spins[j].period;
+
+	return cycles;
+}
+
+// skips the cycles in which nothing happens, returning how many
+static long long fast_forward(State *s[], unsigned long long *gcycles){
+	long long cycles = -1, c, ticks, tick;
+	int j;
+
+	for(j=0;j<n_cores;j++){
+		c = quiet_cycles(s[j], j);
+		if (c >= 0 && (cycles < 0 || c < cycles))
+			cycles = c;
+		if (cycles == 0 || cycles == 1)
+			return 0;
+	}
+	if (cycles < 0 || !idleNetwork())
+		return 0;
+
+	do {
+		c = cycles;
+		for(j=0;j<n_cores;j++)
+			if (!brkpt[j] && !sleeping[j] && spin_ready(j))
+				cycles -= cycles % spins[j].period;
+	} while (cycles != c);
+	if (cycles < 2)
+		return 0;
+
+	for(j=0;j<n_cores;j++){
+		if (brkpt[j])
+			continue;
+		tick = HWMemory[4][j];
+		if (tick){
+			ticks = (cpu_cycles[j] + cycles) / tick - cpu_cycles[j] / tick;
+			if (ticks > 0)
+				tick_toggle(j);
+			if (ticks > 1 && (ticks - 1) % 2)
+				tick_toggle(j);
+		}
+		if (!(HWMemory[2][j] & IRQ_UART_WRITE_AVAILABLE) && uart_delay[j] > 0){
+			uart_delay[j] -= cycles;
+			io_counter[j] += cycles;
+		}else{
+			uart_delay[j] = UART_DELAY;
+			HWMemory[2][j] |= IRQ_UART_WRITE_AVAILABLE;
+		}
+		if (sleeping[j])
+			sleep_cycles[j] += cycles;
+		else if (spin_ready(j))
+			spin_skip(j, cycles);
+		else
+			pause_cpu[j] -= cycles;
+		cpu_cycles[j] += cycles;
+	}
+	skipNetwork((*gcycles + cycles) / CPU_NETWORK_CLK_RATIO - *gcycles / CPU_NETWORK_CLK_RATIO);
+	*gcycles += cycles;
+
+	return cycles;
+}
+
+static void write_reports(void){
+	char report_string[]= "./reports/report\0\0\0\0\0\0\0\0\0\0";
+	int j;
+
+	printf("\n");
+	for(j=0;j<n_cores;j++){
+		show_cpu_stats(strcat(strcat(report_string, itoa(j)),".txt"),j);
+		strcpy(report_string, "./reports/report\0\0\0\0\0\0\0\0\0\0\0");
+	}
+	show_mpsoc_stats("./reports/mpsoc.txt");
+}
+
+#ifndef BUS
+/*
+	PARALLEL SIMULATION
+
+	cores, network interfaces and routers are split in contiguous ranges, one per thread. a thread
+	runs its range for a quantum of cycles, synchronizing only the links inside of it. links between
+	ranges are synchronized by the thread of the sending router once all threads reach the end of
+	the quantum, so each port of these links is only written by one thread between two barriers.
+	with a quantum of one cycle, the result is the same as the serial simulation. larger quanta
+	delay the flits crossing a range boundary by up to a quantum. idle cycles are fast-forwarded
+	between quanta by the last thread to reach the barrier, while the others wait.
+*/
+
+typedef struct {
+	pthread_t thread;
+	int first;			// cores and routers [first, last) belong to this thread
+	int last;
+	State **s;
+	FILE **std_out;
+} SimThread;
+
+static int n_threads = 1;
+static int quantum = 1;
+static volatile int barrier_count = 0;
+static volatile int barrier_sense = 0;
+static volatile int threads_done = 0;
+static long long ff_cycles = 0;		// cycles fast-forwarded at the last barrier
+
+// sense reversing barrier. threads spin for a while before yielding the host cpu. with s, the last
+// thread to arrive fast-forwards idle cycles of the whole system from gcycles
+static void barrier_wait(int *sense, State **s, unsigned long long gcycles){
+	int spin;
+
+	*sense = !*sense;
+	if (__atomic_add_fetch(&barrier_count, 1, __ATOMIC_ACQ_REL) == n_threads){
+		if (s)
+			ff_cycles = fast_forward(s, &gcycles);
+		__atomic_store_n(&barrier_count, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&barrier_sense, *sense, __ATOMIC_RELEASE);
+	}else{
+		for(spin = 0; __atomic_load_n(&barrier_sense, __ATOMIC_ACQUIRE) != *sense; spin++)
+			if (spin > 1000)
+				sched_yield();
+	}
+}
+
+static void *sim_thread(void *arg){
+	SimThread *t = (SimThread *)arg;
+	unsigned long long gcycles = 0;
+	int j, q, last_core, done = 0, sense = 0;
+
+	last_core = t->last < n_cores ? t->last : n_cores;
+	if (last_core < t->first)
+		last_core = t->first;
+
+	while(1){
+		barrier_wait(&sense, t->s, gcycles);
+		if (threads_done == n_threads)
+			return NULL;
+		gcycles += ff_cycles;
+		for(j=t->first;j<t->last;j++)
+			synchronizeRouterLinks(j, t->first, t->last, ON);
+		barrier_wait(&sense, NULL, 0);
+
+		for(q=0;q<quantum;q++){
+			for(j=t->first;j<last_core;j++)
+				if (brkpt[j] == 0)
+					cycle_irq(t->s[j], j);
+
+			gcycles++;
+
+			for(j=t->first;j<last_core;j++)
+				cycle_port(j);
+
+			for(j=t->first;j<t->last;j++){
+				synchronizeRouterLinks(j, t->first, t->last, OFF);
+				synchronizeNetworkInterface(j);
+				synchronizeCore(j);
+			}
+
+			for(j=t->first;j<t->last;j++){
+				if (gcycles % CPU_NETWORK_CLK_RATIO == 0)
+					cycleRouter(j);
+				cycleNetworkInterface(j);
+			}
+
+			for(j=t->first;j<last_core;j++)
+				if (brkpt[j] == 0 && dma_ctrl[j])
+					cycle_dma(t->s[j], j);
+
+			for(j=t->first;j<last_core;j++){
+				if (brkpt[j] == 0)
+					cycle_cpu(t->s[j], j, t->std_out[j]);
+				else
+					halted[j] = 1;
+			}
+		}
+
+		if (!done){
+			for(j=t->first;j<last_core;j++)
+				if (halted[j] == 0) break;
+			if (j == last_core){
+				done = 1;
+				__atomic_add_fetch(&threads_done, 1, __ATOMIC_RELEASE);
+			}
+		}
+	}
+}
+
+static int do_parallel(State *s[], FILE *std_out[]){
+	SimThread threads[MAX_N_CORES];
+	int i;
+
+	if (n_threads > N_CORES)
+		n_threads = N_CORES;
+	for(i=0;i<n_threads;i++){
+		threads[i].first = N_CORES * i / n_threads;
+		threads[i].last = N_CORES * (i + 1) / n_threads;
+		threads[i].s = s;
+		threads[i].std_out = std_out;
+	}
+	for(i=1;i<n_threads;i++){
+		if (pthread_create(&threads[i].thread, NULL, sim_thread, &threads[i])){
+			printf("\nCould not create simulation thread %d.\n", i);
+			fflush(stdout);
+			exit(-1);
+		}
+	}
+	sim_thread(&threads[0]);
+	for(i=1;i<n_threads;i++)
+		pthread_join(threads[i].thread, NULL);
+
+	write_reports();
+
+	return 0;
+}
+#endif
+
+int do_debug(State *s[], FILE *std_out[]){
+	int j;
+	unsigned long long gcycles = 0;
+
 	for(j=0;j<MAX_N_CORES;j++){
-		l = -1;
-		m = -1;
-		n[j] = 0;
+		halted[j] = 0;
 		pause_cpu[j] = 0;
 		irq_counter[j] = 0;
 	}
@@ -1151,85 +2098,26 @@ int do_debug(State *s[], FILE *std_out[]){
 		cycle(s[j], 0, j, std_out[j], &pause_cpu[j], &irq_counter[j]);
 	}
 
-	while(1){
-		for(j=0;j<n_cores;j++){
-			if (brkpt[j] == 0){
-				if ((cpu_cycles[j] & ((long long)HWMemory[4][j] - 1)) == ((long long)HWMemory[4][j] - 1)){
-					if (HWMemory[1][j] & (IRQ_COUNTER18 | IRQ_COUNTER18_NOT)){
-//					if ((HWMemory[1][j] & (IRQ_COUNTER18 | IRQ_COUNTER18_NOT)) && ((HWMemory[2][j] & IRQ_NOC_READ) == 0) ){
-						if(s[j]->status == 1) irq_counter[j] = 1;
-					}
-					if (HWMemory[2][j] & IRQ_COUNTER18){
-						HWMemory[2][j] &= ~IRQ_COUNTER18;
-						HWMemory[2][j] |= IRQ_COUNTER18_NOT;
-					}else{
-						HWMemory[2][j] &= ~IRQ_COUNTER18_NOT;
-						HWMemory[2][j] |= IRQ_COUNTER18;
-					}
-				}
+#ifndef BUS
+	if (n_threads > 1)
+		return do_parallel(s, std_out);
+	eventNetwork();
+#endif
 
-				if ((!(HWMemory[2][j] & IRQ_UART_WRITE_AVAILABLE)) && (uart_delay[j]) > 0){
-					uart_delay[j]--;
-					io_counter[j]++;
-				}else{
-					uart_delay[j] = UART_DELAY;
-					HWMemory[2][j] |= IRQ_UART_WRITE_AVAILABLE;
-				}
+	while(1){
+		fast_forward(s, &gcycles);
 
-				core = getCore(j);
-				port = &(core->port);
-				ni = getNetworkInterface(j);
-				buffer = getBuffer(ni, NOC);
-				if(isFull(buffer) && port->in_request == ON && flits_remaining[j] == 0 )//&& irq_counter[j] == 0)
-				// to create a noc interrupt the buffer need to be full and requesing to send the first flit,
-				// there also can't be any thing on the idle buffer and a clock interrupt can't be generated at the same cycle
-				{
-					if(HWMemory[1][j] & IRQ_NOC_READ)
-					// não mascarada					
-					{
-						if(s[j]->status == 1)
-						// interrupções habilitadas
-						{
-							flits_remaining[j] = OS_PACKET_SIZE+1;
-//							irq_counter[j] = 1;
-							irq_counter[j] = 2;
-							HWMemory[2][j] |= IRQ_NOC_READ;
-						}
-					}
-				}
-			}
-		}
+		for(j=0;j<n_cores;j++)
+			if (brkpt[j] == 0)
+				cycle_irq(s[j], j);
 
 		gcycles++;
 
 		for(j=0;j<n_cores;j++)
-		{
-			if(is_sending[j] == ON)
-			{
-				core = getCore(j);
-				port = &(core->port);
-				if(port->out_ack == ON)
-				{
-					port->out = 0;
-					port->out_request = OFF;
-					port->out_ack = OFF;
-					is_sending[j] = OFF;
-				}
-			}
-		}
+			cycle_port(j);
 		
 #ifndef BUS
-		for(j=0;j<N_CORES;j++){
-			synchronizeRouter(j);
-			synchronizeNetworkInterface(j);
-			synchronizeCore(j);
-		}
-		
-		for(j=0;j<N_CORES;j++){
-			if (gcycles % CPU_NETWORK_CLK_RATIO == 0)
-				cycleRouter(j);
-			cycleNetworkInterface(j);
-		}
+		cycleNetwork(gcycles % CPU_NETWORK_CLK_RATIO == 0);
 #else
 		synchronizeRouter(0);
 		for(j=0;j<N_CORES;j++){
@@ -1243,30 +2131,21 @@ int do_debug(State *s[], FILE *std_out[]){
 		}
 #endif
 
+		for(j=0;j<n_cores;j++)
+			if (brkpt[j] == 0 && dma_ctrl[j])
+				cycle_dma(s[j], j);
+
 		for(j=0;j<n_cores;j++){					
 			if (brkpt[j] == 0){			
-				if (pause_cpu[j] == 0 && is_sending[j] == OFF)
-					cycle(s[j], 0, j, std_out[j], &pause_cpu[j], &irq_counter[j]);
-				else if(pause_cpu[j] >= 1)
-					pause_cpu[j]--;
-
-				if (cpu_cycles[j] >= max_cycles){
-					brkpt[j] = 1;
-				}
-				cpu_cycles[j]++;
+				cycle_cpu(s[j], j, std_out[j]);
 			}else{
-				n[j] = 1;
+				halted[j] = 1;
 			}		
 		}
 		for(j=0;j<n_cores;j++)
-			if (n[j] == 0) break;
+			if (halted[j] == 0) break;
 		if (j == n_cores){
-			printf("\n");
-			for(j=0;j<n_cores;j++){
-				show_cpu_stats(strcat(strcat(report_string, itoa(j)),".txt"),j);
-				strcpy(report_string, "./reports/report\0\0\0\0\0\0\0\0\0\0\0");
-			}
-			show_mpsoc_stats("./reports/mpsoc.txt");
+			write_reports();
 			return 0;
 		}
 	}
@@ -1291,6 +2170,12 @@ int main(int argc,char *argv[]){
 		is_sending[j] = 0;
 		is_reading[j] = 0;
 		flits_remaining[j] = 0;
+		rx_first[j] = 0;
+		tx_flits[j] = 0;
+		dma_ctrl[j] = 0;
+		dma_ring_size[j] = 1;
+		dma_tx_flit[j] = -1;
+		dma_rx_flit[j] = -1;
 		
 		s[j] = &context[j];
 		memset(s[j], 0, sizeof(State));
@@ -1306,6 +2191,8 @@ int main(int argc,char *argv[]){
 		GPIOAIN[j] = 0;
 		GPIO0OUT[j] = 0;
 		cpu_cycles[j] = 0;
+		sleep_cycles[j] = 0;
+		sleeping[j] = 0;
 		for(i=0;i<64;i++)
 			ins_counter_op[i][j] = 0;
 		for(i=0;i<64;i++)
@@ -1323,10 +2210,25 @@ int main(int argc,char *argv[]){
 		broadcasts[j] = 0;
 	}	
 
+	for(i=1;i<argc;i++){
+		if (strcmp(argv[i], "-b") == 0){
+			translate_blocks = 1;
+			for(j=i;j<argc-1;j++)
+				argv[j] = argv[j+1];
+			argc--;
+			break;
+		}
+	}
+
 	if(argc <= 1){
-		printf("\nUsage: mpsoc_sim [n_cycles] [frequency]");
+		printf("\nUsage: mpsoc_sim [-b] [n_cycles] [frequency] [threads] [quantum]");
 		printf("\n         or");
 		printf("\n       mpsoc_sim [time unit] e.g. 1000 ns 10 us, 50 ms, 1 s");
+		printf("\n - [threads] (optional) splits cores and routers among host threads,");
+		printf("\n   which synchronize every [quantum] cycles (default: 1, same results");
+		printf("\n   as a single thread). Not available on bus based builds.");
+		printf("\n - -b runs hot blocks of code translated, with the same results as");
+		printf("\n   interpreting them instruction by instruction.");
 		printf("\n - Object codes must be in /objects directory and named");
 		printf("\n   code0.bin, code1.bin, code2.bin...");
 		printf("\n   There must be between 1 and 128 object codes in this directory.");
@@ -1336,7 +2238,7 @@ int main(int argc,char *argv[]){
 		return 0;
 	}
 
-	if(argc == 3 && argv[2][0] != '\0'){
+	if(argc >= 3 && argc <= 5 && argv[2][0] != '\0'){
 		max_cycles = atoll(argv[1]+'\0');
 		if (argv[2][0] == 'c'){
 			sim_metric = 'c';
@@ -1357,6 +2259,17 @@ int main(int argc,char *argv[]){
 			max_cycles *= ((double)reference_clock / 1000000000.0);
 			sim_metric = 'n';
 		}
+#ifndef BUS
+		if (argc >= 4)
+			n_threads = atoi(argv[3]);
+		if (argc == 5)
+			quantum = atoi(argv[4]);
+		if (n_threads < 1 || quantum < 1){
+			printf("\nInvalid number of threads or quantum.\n");
+			fflush(stdout);
+			return (-1);
+		}
+#endif
 	}else{
 		printf("\nType mpsoc_emu for help.\n");
 		fflush(stdout);
@@ -1396,6 +2309,29 @@ int main(int argc,char *argv[]){
 		fclose(in[j]);
 	}
 
+	for(j=0;j<n_cores;j++){
+		decode_cache[j] = (Decoded *)malloc(DECODE_CACHE_SIZE * sizeof(Decoded));
+		if (decode_cache[j] == NULL){
+			printf("\nCould not allocate the instruction cache of core %d.\n", j);
+			fflush(stdout);
+
+			return (-1);
+		}
+		for(i=0;i<DECODE_CACHE_SIZE;i++)
+			decode_cache[j][i].tag = DECODE_INVALID;
+		if (translate_blocks){
+			block_table[j] = (Block *)malloc(BLOCK_TABLE_SIZE * sizeof(Block));
+			block_pages[j] = (unsigned char *)malloc(MEM_SIZE >> BLOCK_PAGE_SHIFT);
+			if (block_table[j] == NULL || block_pages[j] == NULL){
+				printf("\nCould not allocate the block table of core %d.\n", j);
+				fflush(stdout);
+
+				return (-1);
+			}
+			block_flush(j);
+		}
+	}
+
 	for(j=n_cores;j<MAX_N_CORES;j++)
 		brkpt[j] = 1;
 	
@@ -1447,6 +2383,14 @@ int main(int argc,char *argv[]){
 
 	unload_architecture();
 
+	for(j=0;j<n_cores;j++){
+		free(decode_cache[j]);
+		if (translate_blocks){
+			free(block_table[j]);
+			free(block_pages[j]);
+		}
+	}
+
 	return(0);
 }
 
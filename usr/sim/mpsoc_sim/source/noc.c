@@ -44,6 +44,17 @@ Flit read(Buffer* buffer)
 	return buffer->buffer[ buffer->start ];
 }
 
+Flit peek(Buffer* buffer, int i)
+{
+	return buffer->buffer[ (buffer->start + i) % buffer->max ];
+}
+
+// a whole packet (header, payload flit and the number of flits it announces) is on the buffer
+int hasPacket(Buffer* buffer)
+{
+	return buffer->size >= 2 && buffer->size >= peek(buffer, 1) + 2;
+}
+
 Flit take(Buffer* buffer)
 {
 	Flit i = buffer->buffer[ buffer->start ];
@@ -101,6 +112,7 @@ void unload_architecture()
 	free(routers);
 	free(network_interfaces);
 	free(cores);
+	free(active_nodes);
 }
 #else
 void unload_architecture()
@@ -138,11 +150,17 @@ void load_architecture()
 	routers = (Router*) malloc(sizeof(Router)*N_CORES);
 	network_interfaces = (NetworkInterface*) malloc(sizeof(NetworkInterface)*N_CORES);
 	cores = (Core*) malloc(sizeof(Core)*N_CORES);
+	active_nodes = (int*) malloc(sizeof(int)*N_CORES);
+	n_active = 0;
+	network_events = OFF;
+	network_cycles = 0;
 	for( i = 0 ; i < N_CORES ; i++ )
 	{
 		//router
 		router = getRouter(i);
 		router->arbiter = 0;
+		router->active = OFF;
+		router->arbitrated = 0;
 		//network interface
 		network_interface = getNetworkInterface(i);
 		create(getBuffer(network_interface, NOC), NI_BUFFER_LENGTH);
@@ -156,6 +174,7 @@ void load_architecture()
 			router->packets_remaining[k] = 0;
 			router->status[k] = IDLE;
 			router->redirect_to[k] = NONE;
+			router->redirect_mask[k] = 0;
 			router->routing_delay[k] = NONE;
 			create(getBuffer(router, k), NOC_BUFFER_SIZE);
 			//ports
@@ -208,10 +227,206 @@ void load_architecture()
 #endif
 
 #ifndef BUS
+/*
+	XY tree multicast: splits the rectangle of a multicast header among the output ports of router n,
+	filling the header to be sent on each port. A branch never goes back to the input port, so a packet
+	is not delivered to the core which injected it. Returns the mask of output ports.
+*/
+int multicastRoute(int n, int in, Flit header, Flit *branch)
+{
+	int x0, y0, x1, y1, c, l, mask = 0;
+
+	x0 = (header >> 4) & 0xf;
+	y0 = header & 0xf;
+	x1 = x0 + ((header >> 12) & 0xf);
+	y1 = y0 + ((header >> 8) & 0xf);
+	c = GET_COLUMN(n);
+	l = GET_LINE(n);
+
+	if( c < x0 )
+	{
+		mask |= 1 << EAST;
+		branch[EAST] = header;
+	}
+	else if( c > x1 )
+	{
+		mask |= 1 << WEST;
+		branch[WEST] = header;
+	}
+	else
+	{
+		if( x1 > c )
+		{
+			mask |= 1 << EAST;
+			branch[EAST] = rectToHeader(c+1, y0, x1, y1);
+		}
+		if( x0 < c )
+		{
+			mask |= 1 << WEST;
+			branch[WEST] = rectToHeader(x0, y0, c-1, y1);
+		}
+		if( l < y0 )
+		{
+			mask |= 1 << NORTH;
+			branch[NORTH] = rectToHeader(c, y0, c, y1);
+		}
+		else if( l > y1 )
+		{
+			mask |= 1 << SOUTH;
+			branch[SOUTH] = rectToHeader(c, y0, c, y1);
+		}
+		else
+		{
+			if( y1 > l )
+			{
+				mask |= 1 << NORTH;
+				branch[NORTH] = rectToHeader(c, l+1, c, y1);
+			}
+			if( y0 < l )
+			{
+				mask |= 1 << SOUTH;
+				branch[SOUTH] = rectToHeader(c, y0, c, l-1);
+			}
+			if( in != LOCAL )
+			{
+				mask |= 1 << LOCAL;
+				branch[LOCAL] = decimalToHeader(n);
+			}
+		}
+	}
+
+	return mask & ~(1 << in);
+}
+
+/*
+	checks if all output ports of a multicast connection acknowledged the last flit
+*/
+int multicastAcked(Router *router, int i)
+{
+	int p;
+
+	for( p = 0 ; p < 5 ; p++ )
+	{
+		if( (router->redirect_mask[i] & (1 << p)) && getPort(router, p)->out_ack == OFF )
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+	sends a flit on all output ports of a multicast connection. the header flit is replaced by the header of each branch.
+*/
+void multicastSend(Router *router, int i, Flit flit, int header)
+{
+	int p;
+	Port *port_dest;
+
+	for( p = 0 ; p < 5 ; p++ )
+	{
+		if( router->redirect_mask[i] & (1 << p) )
+		{
+			port_dest = getPort(router, p);
+			port_dest->out = header ? router->branch_header[i][p] : flit;
+			port_dest->out_request = ON;
+			port_dest->out_ack = OFF;
+		}
+	}
+}
+
+// round robin arbiter, skipping the ports a router at the border of the mesh doesn't have
+static void arbitrate(int n, Router *router)
+{
+	int l, c;
+
+	router->arbiter = ++router->arbiter % 5;
+
+
+	if( ARBITRATION_CONSIDERING_POS == 1 )
+	{
+		l = GET_LINE(n);
+		c = GET_COLUMN(n);
+		if( l == 0 && c == 0)
+		{
+			if( router->arbiter == WEST )
+			{
+				router->arbiter = NORTH;
+			}
+			else if( router->arbiter == SOUTH )
+			{
+			router->arbiter = LOCAL;
+			}
+		}
+		else if( l == 0 && c == NOC_WIDTH-1 )
+		{
+			if( router->arbiter == EAST )
+			{
+				router->arbiter = WEST;
+			}
+			else if( router->arbiter == SOUTH )
+			{
+				router->arbiter = LOCAL;
+			}
+		}
+		else if( l == NOC_HEIGHT-1 && c == 0 )
+		{
+			if( router->arbiter == WEST )
+			{
+				router->arbiter = SOUTH;
+			}
+			else if( router->arbiter == NORTH )
+			{
+				router->arbiter = LOCAL;
+			}
+		}
+		else if( l == NOC_HEIGHT-1 && c == NOC_WIDTH-1 )
+		{
+			if( router->arbiter == EAST )
+			{
+				router->arbiter = WEST;
+			}
+			else if( router->arbiter == NORTH )
+			{
+				router->arbiter = SOUTH;
+			}
+		}
+		else if( l == 0 )
+		{
+			if( router->arbiter == SOUTH )
+			{
+			router->arbiter = LOCAL;
+			}
+		}
+		else if( c == 0 )
+		{
+			if( router->arbiter == WEST )
+			{
+				router->arbiter = NORTH;
+			}
+		}
+		else if( l == NOC_HEIGHT-1 )
+		{
+			if( router->arbiter == NORTH )
+			{
+				router->arbiter = SOUTH;
+			}
+		}
+		else if( c == NOC_WIDTH-1 )
+		{
+			if( router->arbiter == EAST )
+			{
+				router->arbiter = WEST;
+			}
+		}
+	}
+}
+
 void cycleRouter(int n)
 {
 	unsigned char in_use = 0, active = 0;
-	int i, j, dest, l, c;
+	int i, j, dest, mask;
 	long long int header;
 	Flit flit;
 	Router *router = getRouter(n);
@@ -220,7 +435,8 @@ void cycleRouter(int n)
 
 	for( i = 0 ; i < 5 ; i++ )
 	{
-		if( router->ports[i].in_request == ON )
+		// a flit is taken once: links between threads may only be synchronized at the end of a quantum
+		if( router->ports[i].in_request == ON && router->ports[i].in_ack == OFF )
 		{
 			buffer = getBuffer(router, i);
 			if( ! isFull( buffer ) )
@@ -254,7 +470,11 @@ void cycleRouter(int n)
 			header = (long long int) flit;
 			header = headerToDecimal(header);
 		    
-			if( GET_LINE(n) == GET_LINE(header) && GET_COLUMN(n) == GET_COLUMN(header) )
+			if( isMulticast(flit) )
+			{
+				dest = NONE;
+			}
+			else if( GET_LINE(n) == GET_LINE(header) && GET_COLUMN(n) == GET_COLUMN(header) )
 			{
 				dest = LOCAL;
 			}
@@ -275,12 +495,21 @@ void cycleRouter(int n)
 				dest = NORTH;
 			}
 			
+			if( dest == NONE )
+			{
+				mask = multicastRoute(n, i, flit, router->branch_header[i]);
+			}
+			else
+			{
+				mask = 1 << dest;
+			}
+
 			in_use = 0;
 			for( j = 0 ; j < 5 ; j++ )
 			{
 				if( j != i )
 				{
-					if( router->status[j] != IDLE && router->redirect_to[j] == dest )
+					if( router->status[j] != IDLE && (router->redirect_mask[j] & mask) )
 					{
 			        		in_use = 1;
 			        	}
@@ -290,6 +519,7 @@ void cycleRouter(int n)
 			if( ! in_use )
 			{
 				router->redirect_to[i] = dest;
+				router->redirect_mask[i] = mask;
 				router->status[i] = ROUTING_DELAY;
 		        	router->routing_delay[i] = ROUTING_ALGORITHM_DELAY;
 				active = 1;
@@ -300,7 +530,53 @@ void cycleRouter(int n)
 
 	for( i = 0 ; i <= 4 ; i++ )
 	{
-		if( router->status[i] != IDLE )
+		if( router->status[i] != IDLE && router->redirect_to[i] == NONE )
+		{
+			buffer = getBuffer(router, i);
+			if( router->status[i] == ROUTING_DELAY )
+			{
+				if( router->routing_delay[i]-- <= 0 && ! isEmpty( buffer ) )
+				{
+					multicastSend(router, i, take(buffer), 1);
+					router->status[i] = ROUTING_HEADER;
+				}
+			}
+			else if( multicastAcked(router, i) )
+			{
+				if( router->status[i] == ROUTING_HEADER )
+				{
+					if( ! isEmpty( buffer ) )
+					{
+						flit = take(buffer);
+						multicastSend(router, i, flit, 0);
+						router->packets_remaining[i] = (long long int) flit;
+						router->status[i] = ROUTING_DATA;
+					}
+				}
+				else if( router->packets_remaining[i] == 0 )
+				{
+					for( j = 0 ; j < 5 ; j++ )
+					{
+						if( router->redirect_mask[i] & (1 << j) )
+						{
+							port_dest = getPort(router, j);
+							port_dest->out_request = OFF;
+							port_dest->out = 0;
+							port_dest->out_ack = OFF;
+						}
+					}
+					router->status[i] = IDLE;
+					router->packets_remaining[i] = 0;
+					router->redirect_mask[i] = 0;
+				}
+				else if( ! isEmpty( buffer ) )
+				{
+					multicastSend(router, i, take(buffer), 0);
+					router->packets_remaining[i]--;
+				}
+			}
+		}
+		else if( router->status[i] != IDLE )
 		{
 			buffer = getBuffer(router, i);
 			port_dest = getPort(router, router->redirect_to[i]);
@@ -346,6 +622,7 @@ void cycleRouter(int n)
 							router->status[i] = IDLE;
 							router->packets_remaining[i] = 0;
 							router->redirect_to[i] = NONE;
+							router->redirect_mask[i] = 0;
 							port_dest->out_request = OFF;
 							port_dest->out = 0;
 							port_dest->out_ack = OFF;
@@ -367,86 +644,7 @@ void cycleRouter(int n)
 		}
 	}   
     
-	router->arbiter = ++router->arbiter % 5;
-
-
-	if( ARBITRATION_CONSIDERING_POS == 1 )
-	{
-		l = GET_LINE(n);
-		c = GET_COLUMN(n);
-		if( l == 0 && c == 0)
-		{
-			if( router->arbiter == WEST )
-			{
-				router->arbiter = NORTH;
-			}
-			else if( router->arbiter == SOUTH )
-			{
-			router->arbiter = LOCAL;
-			}
-		}
-		else if( l == 0 && c == NOC_WIDTH-1 )
-		{
-			if( router->arbiter == EAST )
-			{
-				router->arbiter = WEST;
-			}
-			else if( router->arbiter == SOUTH )
-			{
-				router->arbiter = LOCAL;
-			}
-		}
-		else if( l == NOC_HEIGHT-1 && c == 0 )
-		{
-			if( router->arbiter == WEST )
-			{
-				router->arbiter = SOUTH;
-			}
-			else if( router->arbiter == NORTH )
-			{
-				router->arbiter = LOCAL;
-			}
-		}
-		else if( l == NOC_HEIGHT-1 && c == NOC_WIDTH-1 )
-		{
-			if( router->arbiter == EAST )
-			{
-				router->arbiter = WEST;
-			}
-			else if( router->arbiter == NORTH )
-			{
-				router->arbiter = SOUTH;
-			}
-		}
-		else if( l == 0 )
-		{
-			if( router->arbiter == SOUTH )
-			{
-			router->arbiter = LOCAL;
-			}
-		}
-		else if( c == 0 )
-		{
-			if( router->arbiter == WEST )
-			{
-				router->arbiter = NORTH;
-			}
-		}
-		else if( l == NOC_HEIGHT-1 )
-		{
-			if( router->arbiter == NORTH )
-			{
-				router->arbiter = SOUTH;
-			}
-		}
-		else if( c == NOC_WIDTH-1 )
-		{
-			if( router->arbiter == EAST )
-			{
-				router->arbiter = WEST;
-			}
-		}
-	}
+	arbitrate(n, router);
 }
 #else
 void cycleRouter(int n)
@@ -675,7 +873,9 @@ void synchronizePorts(Port *p1, Port *p2)
 }
 
 #ifndef BUS
-void synchronizeRouter(int n)
+// synchronizes the links from router n to its neighbours. with boundary OFF, the local port and the links to
+// routers inside [first, last) are synchronized; with boundary ON, only the links to routers outside of it
+void synchronizeRouterLinks(int n, int first, int last, int boundary)
 {
 	int l, c;
 	Router *router = getRouter(n);
@@ -734,7 +934,21 @@ void synchronizeRouter(int n)
 	{
         	p2 = &(core->port);
     	}
-    	synchronizePorts(p1, p2);
+	if( boundary == OFF )
+	{
+    		synchronizePorts(p1, p2);
+	}
+	for( c = 0 ; c < 4 && (first > 0 || last < N_CORES || boundary == ON) ; c++ )
+	{
+		if( flags[c] )
+		{
+			l = n + (c == SOUTH ? -NOC_WIDTH : c == NORTH ? NOC_WIDTH : c == EAST ? 1 : -1);
+			if( (l >= first && l < last) == boundary )
+			{
+				flags[c] = OFF;
+			}
+		}
+	}
 	
 	if( flags[SOUTH] )
 	{
@@ -765,6 +979,11 @@ void synchronizeRouter(int n)
 		synchronizePorts(p1, p2);
 	}
 }
+
+void synchronizeRouter(int n)
+{
+	synchronizeRouterLinks(n, 0, N_CORES, OFF);
+}
 #else
 void synchronizeRouter(int n)
 {
@@ -876,3 +1095,214 @@ void synchronizeCore(int n)
 }
 #endif
 
+// a port without requests or acknowledges pending
+static int idlePort(Port *port)
+{
+	return port->in_request == OFF && port->in_ack == OFF && port->out_request == OFF && port->out_ack == OFF;
+}
+
+// nothing buffered or being transferred between the network interface n and its core
+static int idleInterface(int n)
+{
+	NetworkInterface *ni = getNetworkInterface(n);
+
+	return isEmpty(getBuffer(ni, PLASMA)) && isEmpty(getBuffer(ni, NOC)) && idlePort(getPort(ni, PLASMA)) && idlePort(getPort(ni, NOC)) && idlePort(&(getCore(n)->port));
+}
+
+static int idleRouter(Router *router)
+{
+	int i;
+
+	for( i = 0 ; i < ROUTERSIZE ; i++ )
+	{
+		if( router->status[i] != IDLE || ! isEmpty(getBuffer(router, i)) || ! idlePort(getPort(router, i)) )
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+#ifndef BUS
+// moves the arbiter of router n by a number of network cycles. it walks a cycle of at most 5 ports, whose length divides 60
+static void arbitrateCycles(int n, long long cycles)
+{
+	if( cycles > 5 )
+	{
+		cycles = 5 + (cycles - 5) % 60;
+	}
+	while( cycles-- > 0 )
+	{
+		arbitrate(n, getRouter(n));
+	}
+}
+
+// a node (router, network interface and core port) without flits or handshakes pending
+static int idleNode(int n)
+{
+	return idleRouter(getRouter(n)) && idleInterface(n);
+}
+#endif
+
+// no flit is buffered or being transferred anywhere: synchronizing and cycling the network does nothing
+// but moving the arbiters of the routers
+int idleNetwork()
+{
+	int n;
+
+#ifndef BUS
+	if( network_events == ON )
+	{
+		return n_active == 0;
+	}
+	for( n = 0 ; n < N_CORES ; n++ )
+	{
+		if( ! idleNode(n) )
+		{
+			return 0;
+		}
+	}
+#else
+	if( ! idleRouter(getRouter(0)) )
+	{
+		return 0;
+	}
+	for( n = 0 ; n < N_CORES ; n++ )
+	{
+		if( ! idleInterface(n) )
+		{
+			return 0;
+		}
+	}
+#endif
+	return 1;
+}
+
+// advances an idle network by a number of router cycles
+void skipNetwork(long long cycles)
+{
+	int n;
+#ifndef BUS
+	if( network_events == ON )
+	{
+		network_cycles += cycles;
+		return;
+	}
+	for( n = 0 ; n < N_CORES ; n++ )
+	{
+		arbitrateCycles(n, cycles);
+	}
+#else
+	while( cycles-- > 0 )
+	{
+		cycleRouter(0);
+	}
+#endif
+}
+
+#ifndef BUS
+/*
+	EVENT DRIVEN NETWORK
+
+	an idle node does nothing but moving the arbiter of its router, so only the set of active nodes is
+	synchronized and cycled. a node joins the set when a neighbour requests to send it a flit or when its
+	core writes to the network (wakeNode()), and leaves it once idle again. the arbiter of a router that
+	was left out is brought up to date when it wakes up, so flits move exactly as on the whole mesh.
+*/
+
+// router next to router n on a direction, -1 at the border of the mesh
+static int neighbour(int n, int direction)
+{
+	switch( direction )
+	{
+		case EAST:	return GET_COLUMN(n) < NOC_WIDTH-1 ? n+1 : -1;
+		case WEST:	return GET_COLUMN(n) > 0 ? n-1 : -1;
+		case NORTH:	return GET_LINE(n) < NOC_HEIGHT-1 ? n+NOC_WIDTH : -1;
+		default:	return GET_LINE(n) > 0 ? n-NOC_WIDTH : -1;
+	}
+}
+
+// switches the serial simulation to the event driven network
+void eventNetwork()
+{
+	int n;
+
+	network_events = ON;
+	for( n = 0 ; n < N_CORES ; n++ )
+	{
+		if( ! idleNode(n) )
+		{
+			wakeNode(n);
+		}
+	}
+}
+
+void wakeNode(int n)
+{
+	Router *router = getRouter(n);
+
+	if( network_events == OFF || router->active == ON )
+	{
+		return;
+	}
+	arbitrateCycles(n, network_cycles - router->arbitrated);
+	router->arbitrated = network_cycles;
+	router->active = ON;
+	active_nodes[ n_active++ ] = n;
+}
+
+// one cycle of the network (routers are cycled only on router_cycle), touching the active nodes only.
+// links are synchronized in any order: each one writes the input of a port and the acknowledge of another
+void cycleNetwork(int router_cycle)
+{
+	int i, j, n, m;
+	Router *router;
+
+	for( i = 0 ; i < n_active ; i++ )
+	{
+		n = active_nodes[i];
+		synchronizeRouter(n);
+		synchronizeNetworkInterface(n);
+		synchronizeCore(n);
+		for( j = 0 ; j < 4 ; j++ )
+		{
+			m = neighbour(n, j);
+			// the port facing router n is on the opposite direction (EAST/WEST, NORTH/SOUTH)
+			if( m >= 0 && getRouter(m)->active == OFF && getPort(getRouter(m), j ^ 1)->in_request == ON )
+			{
+				wakeNode(m);
+			}
+		}
+	}
+
+	for( i = 0 ; i < n_active ; i++ )
+	{
+		n = active_nodes[i];
+		if( router_cycle )
+		{
+			cycleRouter(n);
+			getRouter(n)->arbitrated++;
+		}
+		cycleNetworkInterface(n);
+	}
+	if( router_cycle )
+	{
+		network_cycles++;
+	}
+
+	for( i = 0, j = 0 ; i < n_active ; i++ )
+	{
+		n = active_nodes[i];
+		router = getRouter(n);
+		if( idleNode(n) )
+		{
+			router->active = OFF;
+		}
+		else
+		{
+			active_nodes[ j++ ] = n;
+		}
+	}
+	n_active = j;
+}
+#endif
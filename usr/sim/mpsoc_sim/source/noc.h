@@ -21,6 +21,9 @@ typedef unsigned short int Flit;
 #define decimalToHeader(X)		( GET_COLUMN(X)<<4 | GET_LINE(X) ) 
 #define GET_LINE(n)			((int) n / NOC_WIDTH)
 #define GET_COLUMN(n)			((int) n % NOC_WIDTH)
+// multicast header: rectangle from X0,Y0 (bits 7:0, as a unicast header) to X0+DX,Y0+DY (DX bits 15:12, DY bits 11:8)
+#define isMulticast(X)			( ((unsigned int) X) & 0xff00 )
+#define rectToHeader(x0,y0,x1,y1)	( (((x1)-(x0))<<12) | (((y1)-(y0))<<8) | ((x0)<<4) | (y0) )
 #define getRouter(n)			(&routers[ n ])
 #define getBuffer(x, p)			(&(x->buffers[ p ]))
 #define getNetworkInterface(n)		(&network_interfaces[ n ])
@@ -79,9 +82,13 @@ typedef struct {
 	unsigned char			status[ROUTERSIZE];
 	long long int			packets_remaining[ROUTERSIZE];
 	unsigned char			redirect_to[ROUTERSIZE];
+	unsigned char			redirect_mask[ROUTERSIZE];
+	Flit				branch_header[ROUTERSIZE][ROUTERSIZE];
 	int				routing_delay[ROUTERSIZE];
 	Buffer				buffers[ROUTERSIZE];
 	Port				ports[ROUTERSIZE];
+	unsigned char			active;		// on the set of active nodes (event driven network)
+	long long int			arbitrated;	// network cycles its arbiter is up to date with
 } Router;
 
 int teste(int i);
@@ -92,6 +99,8 @@ int isFull(Buffer* buffer);
 int isEmpty(Buffer* buffer);
 void put(Buffer* buffer, Flit value);
 Flit read(Buffer* buffer);
+Flit peek(Buffer* buffer, int i);
+int hasPacket(Buffer* buffer);
 Flit take(Buffer* buffer);
 void destroy(Buffer* buffer);
 
@@ -103,10 +112,20 @@ void cycleRouter(int n);
 void cycleNetworkInterface(int n);
 void synchronizePorts(Port *p1, Port *p2);
 void synchronizeRouter(int n);
+void synchronizeRouterLinks(int n, int first, int last, int boundary);
 void synchronizeNetworkInterface(int n);
 void synchronizeCore(int n);
+int idleNetwork();
+void skipNetwork(long long cycles);
+void eventNetwork();
+void wakeNode(int n);
+void cycleNetwork(int router_cycle);
 
 // GLOBAL VARS
 Router *routers;
 NetworkInterface *network_interfaces;
 Core *cores;
+int *active_nodes;
+int n_active;
+int network_events;
+long long int network_cycles;